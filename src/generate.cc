@@ -0,0 +1,59 @@
+/*
+ * Generates a binary tape of int32_t values with a chosen distribution.
+ * The same options and seed always give the same tape.
+ */
+
+#include <impl/common.hh>
+#include <impl/generate.hh>
+
+#include <chrono>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using namespace yuliy_test_task;
+
+auto main(int argc, char* argv[]) -> int try {
+  auto const usage = [&] {
+    common::panic(1, "usage: {} [--distribution uniform|small_domain|zipf|sorted|reverse|nearly_sorted|all_equal|organ_pipe] "
+      "[--seed <S>] [--domain <K>] [--skew <s>] [--displacement <D>] [--threads <T>] <count> <output tape>", argv[0]);
+  };
+  auto options = generate::Options();
+  auto positional = std::vector<std::string_view>();
+  for(auto i = 1; i < argc; ++i) {
+    auto const arg = std::string_view(argv[i]);
+    auto const value = [&] {
+      if(++i == argc)
+        usage();
+      return std::string(argv[i]);
+    };
+    if(arg == "--distribution") {
+      auto const distribution = generate::parse_distribution(value());
+      if(not distribution)
+        usage();
+      options.distribution = *distribution;
+    } else if(arg == "--seed")
+      options.seed = std::stoull(value());
+    else if(arg == "--domain")
+      options.domain = std::stoull(value());
+    else if(arg == "--skew")
+      options.skew = std::stod(value());
+    else if(arg == "--displacement")
+      options.displacement = std::stoull(value());
+    else if(arg == "--threads")
+      options.threads = std::stoull(value());
+    else
+      positional.push_back(arg);
+  }
+  if(positional.size() != 2)
+    usage();
+  options.count = std::stoull(std::string(positional[0]));
+  auto const start = std::chrono::steady_clock::now();
+  if(auto const res = generate::write_tape(common::canonicalize(positional[1]), options); not res)
+    common::panic(1, "Error: {}", res.error());
+  auto const elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+  common::println("{} {} values with seed {} in {}", options.count, to_string(options.distribution), options.seed, elapsed);
+  return 0;
+} catch(std::exception const& e) {
+  common::panic(1, "Error: {}", e.what());
+}
@@ -0,0 +1,621 @@
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <fstream>
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include <impl/itape.hh>
+#include <impl/common.hh>
+#include <impl/writer.hh>
+#include <impl/merge.hh>
+#include <impl/sort.hh>
+#if defined __linux__
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace yuliy_test_task::algorithm
+{
+  namespace detail
+  {
+    /**
+     * Makes the contents of a file, or the entries of a directory, durable.
+     *
+     * \param path The file or directory.
+     * \returns An empty result if it was synced, otherwise an std::unexpected with an error message.
+     */
+    [[nodiscard]] inline auto sync_path(std::filesystem::path const& path) -> result_type<void> {
+#if defined __linux__
+      auto const fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+      if(fd < 0)
+        return std::unexpected(std::format("failed to open '{}' to sync it: {}",
+          path.generic_string(), std::error_code(errno, std::system_category()).message()));
+      auto const synced = ::fsync(fd) == 0;
+      auto const error = std::error_code(errno, std::system_category());
+      ::close(fd);
+      if(not synced)
+        return std::unexpected(std::format("failed to sync '{}': {}", path.generic_string(), error.message()));
+#endif
+      return {};
+    }
+  } // namespace detail
+
+  /**
+   * The persistent state of a checkpointed sort, kept in `manifest.ini` of its
+   * checkpoint directory.
+   *
+   * `runs` lists the run files of the current level in order. While runs are
+   * generated, `pass` is 0 and `consumed` counts the input values already in
+   * runs. During merge pass `pass`, the first `merged` runs are the outputs of
+   * the pass and the rest are still to be merged.
+   */
+  struct Manifest
+  {
+    static constexpr inline auto filename = std::string_view("manifest.ini");
+
+    /**
+     * A run file of the checkpoint directory and the number of values in it.
+     */
+    struct Run
+    {
+      std::string name;
+      std::size_t length = 0;
+    };
+
+    std::string input;
+    std::size_t size = 0;
+    std::size_t consumed = 0;
+    std::size_t pass = 0;
+    std::size_t merged = 0;
+    std::vector<Run> runs;
+
+    /**
+     * Reads the manifest of a checkpoint directory.
+     *
+     * \param dir The checkpoint directory.
+     * \returns The manifest, otherwise an std::unexpected with an error message.
+     */
+    [[nodiscard]] static auto load(std::filesystem::path const& dir) -> result_type<Manifest> {
+      auto const path = dir / filename;
+      auto ifs = std::ifstream(path);
+      if(not ifs)
+        return std::unexpected(std::format("no checkpoint manifest at {}", path.generic_string()));
+      auto self = Manifest();
+      try {
+        for(std::string line; std::getline(ifs, line);) {
+          auto const pos = line.find('=');
+          if(pos == std::string::npos)
+            continue;
+          auto const key = common::trimmed(line.substr(0, pos));
+          auto const value = common::trimmed(line.substr(pos + 1));
+          if(key == "input")
+            self.input = value;
+          else if(key == "size")
+            self.size = std::stoull(value);
+          else if(key == "consumed")
+            self.consumed = std::stoull(value);
+          else if(key == "pass")
+            self.pass = std::stoull(value);
+          else if(key == "merged")
+            self.merged = std::stoull(value);
+          else if(key == "run") {
+            auto const colon = value.rfind(':');
+            if(colon == std::string::npos)
+              throw std::invalid_argument(value);
+            self.runs.push_back(Run { .name = value.substr(0, colon), .length = std::stoull(value.substr(colon + 1)) });
+          }
+        }
+      } catch(...) {
+        return std::unexpected(std::format("failed to parse checkpoint manifest '{}'", path.generic_string()));
+      }
+      return self;
+    }
+
+    /**
+     * Replaces the manifest of a checkpoint directory.
+     *
+     * The new manifest is written next to the old one, synced and renamed over
+     * it, and the directory is synced after the rename, so a crash, even of the
+     * system, leaves either of them whole.
+     *
+     * \param dir The checkpoint directory.
+     * \returns An empty result if the manifest was saved, otherwise
+     * an std::unexpected with an error message.
+     */
+    [[nodiscard]] auto save(std::filesystem::path const& dir) const -> result_type<void> {
+      auto const path = dir / filename;
+      auto next = path;
+      next += ".next";
+      {
+        auto ofs = std::ofstream(next, std::ios::trunc);
+        ofs << std::format("input = {}\nsize = {}\nconsumed = {}\npass = {}\nmerged = {}\n",
+          this->input, this->size, this->consumed, this->pass, this->merged);
+        for(auto const& run : this->runs)
+          ofs << std::format("run = {}:{}\n", run.name, run.length);
+        if(not ofs.flush())
+          return std::unexpected(std::format("failed to write checkpoint manifest '{}'", next.generic_string()));
+      }
+      if(auto const res = detail::sync_path(next); not res)
+        return res;
+      auto error = std::error_code();
+      std::filesystem::rename(next, path, error);
+      if(error)
+        return std::unexpected(std::format("failed to replace checkpoint manifest '{}': {}", path.generic_string(), error.message()));
+      return detail::sync_path(dir);
+    }
+  };
+
+  namespace detail
+  {
+    /**
+     * A run file of a checkpointed sort. Unlike a `TempFile`, it has a fixed name
+     * in the checkpoint directory and outlives the process.
+     */
+    template <typename T>
+    class CheckpointRun
+    {
+      public:
+        /**
+         * Opens a run file.
+         *
+         * \param path The path of the file.
+         * \param create If true, the file is created empty, otherwise the existing one is opened.
+         */
+        CheckpointRun(std::filesystem::path path, bool create)
+          : path_(std::move(path)) {
+          if(create)
+            std::ofstream(this->path_, std::ios::binary | std::ios::trunc);
+          // unbuffered: runs are only read and written in blocks that are charged to the memory budget
+          this->stream_.rdbuf()->pubsetbuf(nullptr, 0);
+          this->stream_.open(this->path_, std::ios::binary | std::ios::out | std::ios::in);
+        }
+
+        /**
+         * Reads values from the current position, like a `RunCursor` source.
+         *
+         * A failed read ends the run early, `error()` tells it from the real end.
+         */
+        [[nodiscard]] auto read_n(std::span<T> values) -> std::size_t {
+          this->stream_.read(reinterpret_cast<char*>(values.data()), static_cast<std::streamsize>(values.size_bytes()));
+          if(this->stream_.bad()) {
+            this->error_ = std::format("failed to read run {}", this->path_.generic_string());
+            return 0;
+          }
+          auto const n = static_cast<std::size_t>(this->stream_.gcount()) / sizeof(T);
+          this->stats.reads += n;
+          this->stats.shifts += n;
+          this->stats.bytes += n * sizeof(T);
+          return n;
+        }
+
+        [[nodiscard]] auto write_and_shift_n(std::span<T const> values) -> result_type<void> {
+          if(not this->stream_.write(reinterpret_cast<char const*>(values.data()), static_cast<std::streamsize>(values.size_bytes())))
+            return std::unexpected(std::format("failed to write run {}", this->path_.generic_string()));
+          this->stats.writes += values.size();
+          this->stats.shifts += values.size();
+          this->stats.bytes += values.size_bytes();
+          return {};
+        }
+
+        /**
+         * Makes the values written so far durable and moves to the beginning of the run.
+         *
+         * The values are flushed and synced to the disk, so a manifest saved after
+         * this call never lists a run whose values could be lost.
+         *
+         * \returns An empty result if the run was synced, otherwise
+         * an std::unexpected with an error message.
+         */
+        [[nodiscard]] auto rewind() -> result_type<void> {
+          if(not this->stream_.flush())
+            return std::unexpected(std::format("failed to flush run {}", this->path_.generic_string()));
+          if(auto const res = sync_path(this->path_); not res)
+            return res;
+          this->stream_.seekg(0);
+          this->stream_.seekp(0);
+          ++this->stats.rewinds;
+          return {};
+        }
+
+        /**
+         * Checks that the file holds a whole run.
+         *
+         * \param length The number of values the run should hold.
+         * \returns `true` if the file is open and has the size of the run.
+         */
+        [[nodiscard]] auto holds(std::size_t length) const -> bool {
+          auto error = std::error_code();
+          return this->stream_.is_open() and std::filesystem::file_size(this->path_, error) == length * sizeof(T) and not error;
+        }
+
+        /**
+         * Returns the error of the first failed read, if any.
+         */
+        [[nodiscard]] auto error() const noexcept -> std::optional<std::string> const& { return this->error_; }
+
+        /**
+         * Closes and deletes the file.
+         */
+        auto remove() -> void {
+          this->stream_.close();
+          [[maybe_unused]] auto dummy = std::error_code();
+          std::filesystem::remove(this->path_, dummy);
+        }
+
+        /**
+         * The operations performed on the run, counted as on a tape.
+         */
+        TapeStats stats;
+
+      private:
+        std::filesystem::path path_;
+        std::fstream stream_;
+        std::optional<std::string> error_;
+    };
+
+    /**
+     * An external merge sort that records its progress in a checkpoint directory
+     * and can be continued from it after a crash.
+     *
+     * The sort advances in steps: every step either generates one run or merges
+     * one group of runs. A step writes its run completely, then saves the manifest,
+     * and only then deletes the runs it merged, so the manifest always describes
+     * whole runs. The final merge into the output tape is not checkpointed; it is
+     * repeated from the start after a crash.
+     */
+    template <typename In, typename Out>
+    class CheckpointedSort
+    {
+      public:
+        using T = In::value_type;
+
+        /**
+         * Starts a new sort, or continues the one recorded in the directory.
+         *
+         * \param in The input tape, at its beginning.
+         * \param out The output tape.
+         * \param dir The checkpoint directory.
+         * \param resume If true, the sort continues from the manifest in `dir`.
+         * \param fan_in The number of runs merged at once.
+         * \returns The sort, otherwise an std::unexpected with an error message.
+         */
+        [[nodiscard]] static auto open(
+          In& in,
+          Out& out,
+          std::filesystem::path dir,
+          bool resume,
+          std::size_t fan_in
+        ) -> result_type<CheckpointedSort> {
+          auto self = CheckpointedSort(in, out, std::move(dir), fan_in);
+          auto error = std::error_code();
+          create_directories(self.dir_, error);
+          if(error)
+            return std::unexpected(std::format("failed to create checkpoint directory '{}': {}", self.dir_.generic_string(), error.message()));
+          if(not resume) {
+            self.manifest_ = Manifest {
+              .input = in.filename().generic_string(),
+              .size = in.size(),
+              .consumed = 0,
+              .pass = 0,
+              .merged = 0,
+              .runs = {}
+            };
+            if(auto const res = self.manifest_.save(self.dir_); not res)
+              return std::unexpected(res.error());
+            // the runs of an earlier sort in the directory are not needed anymore
+            self.remove_unlisted_runs();
+            return self;
+          }
+          auto manifest = Manifest::load(self.dir_);
+          if(not manifest)
+            return std::unexpected(manifest.error());
+          if(manifest->input != in.filename().generic_string() or manifest->size != in.size())
+            return std::unexpected(std::format("checkpoint in '{}' is for tape {} of {} elements",
+              self.dir_.generic_string(), manifest->input, manifest->size));
+          self.manifest_ = std::move(*manifest);
+          for(auto const& run : self.manifest_.runs) {
+            auto& file = self.runs_.emplace_back(self.dir_ / run.name, false);
+            if(not file.holds(run.length))
+              return std::unexpected(std::format("checkpointed run {} is incomplete", run.name));
+          }
+          // run files the manifest does not list were left by a step that did not finish
+          self.remove_unlisted_runs();
+          // the values already in runs are passed over without being read
+          for(std::size_t i = 0; i < self.manifest_.consumed; ++i)
+            if(not in.shift(ITape<T>::Direction::Right))
+              return std::unexpected(std::format("failed to pass over element {} of the input tape", i));
+          return self;
+        }
+
+        /**
+         * Runs one step of the sort.
+         *
+         * \returns `true` if a step was made, `false` if only the final merge is
+         * left, otherwise an std::unexpected with an error message.
+         */
+        [[nodiscard]] auto step() -> result_type<bool> {
+          auto& m = this->manifest_;
+          if(m.consumed < m.size)
+            return this->make_run();
+          if(this->runs_.size() <= this->fan_in_)
+            return false;
+          if(m.pass == 0 or m.merged >= this->runs_.size()) {
+            ++m.pass;
+            m.merged = 0;
+          }
+          if(auto const res = this->merge_group(); not res)
+            return std::unexpected(res.error());
+          return true;
+        }
+
+        /**
+         * Merges the remaining runs into the output tape and removes the checkpoint.
+         *
+         * \param progress If true, the function prints progress information.
+         * \param scratch If not null, receives the operations performed on the runs.
+         * \returns An empty result if the function was successful, otherwise
+         * an std::unexpected with an error message.
+         */
+        [[nodiscard]] auto finish(bool progress, TapeStats* scratch) -> result_type<void> {
+          if(progress)
+            common::println("\nSorting...");
+          auto* const budget = &this->out_->config().budget();
+          auto sink = WriteBehindBuffer<T, Out>(*this->out_, this->max_elems_in_ram_ / 4, budget);
+          auto written = std::size_t(0);
+          auto const merged = this->merge(this->runs_, sink, [&](std::size_t n) {
+            written += n;
+            if(progress)
+              common::print_progress(written, this->manifest_.size);
+          });
+          if(auto const res = sink.finish(); not res)
+            return std::unexpected(res.error());
+          if(not merged)
+            return merged;
+          for(auto& run : this->runs_) {
+            this->stats_ += run.stats;
+            run.remove();
+          }
+          this->runs_.clear();
+          if(scratch)
+            *scratch += this->stats_;
+          [[maybe_unused]] auto dummy = std::error_code();
+          std::filesystem::remove(this->dir_ / Manifest::filename, dummy);
+          if(progress)
+            common::println();
+          return {};
+        }
+
+        [[nodiscard]] auto manifest() const noexcept -> Manifest const& { return this->manifest_; }
+
+      private:
+        CheckpointedSort(In& in, Out& out, std::filesystem::path dir, std::size_t fan_in)
+          : in_(&in)
+          , out_(&out)
+          , dir_(std::move(dir))
+          , max_elems_in_ram_(in.config().template ram_limit_elems<T>())
+          , fan_in_(std::min(std::max<std::size_t>(2, fan_in), max_fan_in(this->max_elems_in_ram_)))
+        {}
+
+        /**
+         * Deletes the run files of the directory that the manifest does not list.
+         */
+        auto remove_unlisted_runs() -> void {
+          auto error = std::error_code();
+          for(auto const& entry : std::filesystem::directory_iterator(this->dir_, error)) {
+            auto const name = entry.path().filename().string();
+            if(entry.path().extension() == ".run" and std::ranges::none_of(this->manifest_.runs, [&](auto const& run) { return run.name == name; }))
+              std::filesystem::remove(entry.path(), error);
+          }
+        }
+
+        auto make_run() -> result_type<bool> {
+          auto& m = this->manifest_;
+          auto block = budget_vector<T>(std::min(this->max_elems_in_ram_, m.size - m.consumed), BudgetAllocator<T>(&this->in_->config().budget()));
+          auto const n = this->in_->read_and_shift_n(std::span<T>(block));
+          if(not n)
+            return std::unexpected(n.error());
+          if(*n == 0)
+            return std::unexpected(std::format("read {} of {} elements from the input tape", m.consumed, m.size));
+          auto const data = std::span<T>(block).first(*n);
+          std::sort(data.begin(), data.end());
+          auto const name = common::random_string(32) + ".run";
+          auto& run = this->runs_.emplace_back(this->dir_ / name, true);
+          if(auto const res = run.write_and_shift_n(data); not res)
+            return std::unexpected(res.error());
+          if(auto const res = run.rewind(); not res)
+            return std::unexpected(res.error());
+          m.runs.push_back(Manifest::Run { .name = name, .length = *n });
+          m.consumed += *n;
+          if(auto const res = m.save(this->dir_); not res)
+            return std::unexpected(res.error());
+          return true;
+        }
+
+        auto merge_group() -> result_type<void> {
+          auto& m = this->manifest_;
+          auto const first = m.merged;
+          auto const count = std::min(this->fan_in_, this->runs_.size() - first);
+          if(count == 1) {
+            ++m.merged;
+            return m.save(this->dir_);
+          }
+          auto const name = common::random_string(32) + ".run";
+          auto run = CheckpointRun<T>(this->dir_ / name, true);
+          auto length = std::size_t(0);
+          {
+            auto* const budget = &this->in_->config().budget();
+            auto sink = WriteBehindBuffer<T, CheckpointRun<T>>(run, this->max_elems_in_ram_ / 4, budget);
+            auto const merged = this->merge(std::span(this->runs_).subspan(first, count), sink, [&](std::size_t n) { length += n; });
+            if(auto const res = sink.finish(); not res)
+              return res;
+            if(not merged) {
+              run.remove();
+              return merged;
+            }
+          }
+          if(auto const res = run.rewind(); not res)
+            return res;
+          auto const group = m.runs.begin() + static_cast<std::ptrdiff_t>(first);
+          *group = Manifest::Run { .name = name, .length = length };
+          m.runs.erase(group + 1, group + static_cast<std::ptrdiff_t>(count));
+          ++m.merged;
+          if(auto const res = m.save(this->dir_); not res)
+            return res;
+          // the merged runs are only deleted once the manifest no longer lists them
+          auto const runs = this->runs_.begin() + static_cast<std::ptrdiff_t>(first);
+          for(auto it = runs; it != runs + static_cast<std::ptrdiff_t>(count); ++it) {
+            this->stats_ += it->stats;
+            it->remove();
+          }
+          *runs = std::move(run);
+          this->runs_.erase(runs + 1, runs + static_cast<std::ptrdiff_t>(count));
+          return {};
+        }
+
+        template <typename Sink, typename OnEmit>
+        [[nodiscard]] auto merge(std::span<CheckpointRun<T>> runs, Sink& sink, OnEmit&& on_emit) -> result_type<void> {
+          auto* const budget = &this->in_->config().budget();
+          auto const block = cursor_block_elems<T>(this->max_elems_in_ram_ / 2, runs.size());
+          auto cursors = std::vector<RunCursor<T, CheckpointRun<T>>>();
+          cursors.reserve(runs.size());
+          for(auto& run : runs)
+            cursors.emplace_back(run, block, budget);
+          algorithm::detail::merge(cursors, sink, on_emit, std::less<>(), budget);
+          for(auto const& run : runs)
+            if(run.error())
+              return std::unexpected(*run.error());
+          return {};
+        }
+
+        In* in_;
+        Out* out_;
+        std::filesystem::path dir_;
+        std::size_t max_elems_in_ram_;
+        std::size_t fan_in_;
+        Manifest manifest_;
+        std::vector<CheckpointRun<T>> runs_;
+        TapeStats stats_;
+    };
+  } // namespace detail
+
+
+  /**
+   * Sorts the input tape with an external merge that can be resumed after a crash.
+   *
+   * Runs are kept in the checkpoint directory instead of the scratch space, and
+   * its manifest records every completed run and merge step. With `resume`, the
+   * sort continues from the manifest: the input tape is moved past the values
+   * already in runs without reading them, and the merge goes on from the last
+   * completed group.
+   *
+   * \param in The input tape.
+   * \param out The output tape.
+   * \param dir The checkpoint directory.
+   * \param resume If true, the sort continues from the manifest in `dir`.
+   * \param progress If true, the function prints progress information.
+   * \param scratch If not null, receives the operations performed on the runs.
+   * \returns An empty result if the function was successful, otherwise
+   * an std::unexpected with an error message.
+   */
+  template <typename In, typename Out>
+  [[nodiscard]] auto sort_checkpointed_into(
+    In& in,
+    Out& out,
+    std::filesystem::path const& dir,
+    bool resume = false,
+    bool progress = false,
+    TapeStats* scratch = nullptr
+  ) -> result_type<void> {
+    auto sort = detail::CheckpointedSort<In, Out>::open(in, out, dir, resume, std::numeric_limits<std::size_t>::max());
+    if(not sort)
+      return std::unexpected(sort.error());
+    if(progress)
+      common::println("\n{} checkpointed sort in {}", resume ? "Resuming" : "Starting", dir.generic_string());
+    for(auto steps = std::size_t(1);; ++steps) {
+      auto const res = sort->step();
+      if(not res)
+        return std::unexpected(res.error());
+      if(not *res)
+        break;
+      if(progress)
+        common::print_progress(sort->manifest().consumed, sort->manifest().size);
+    }
+    return sort->finish(progress, scratch);
+  }
+} // namespace yuliy_test_task::algorithm
+
+#if defined UNIT_TESTS
+#include <gtest/gtest.h>
+#include <impl/tape.hh>
+
+TEST(Sort, checkpointed_sort_resumes_after_a_crash)
+{
+  using namespace yuliy_test_task;
+  using namespace yuliy_test_task::algorithm;
+  auto const config = *Config::from_pwd();
+  auto const dir = std::filesystem::temp_directory_path() / std::format("yuliy_test_task_{}", common::random_string(16));
+  auto const path = dir / "out.tape";
+  using Tape = BinaryTape<int32_t, NoDelay>;
+  auto consumed = std::size_t(0);
+  {
+    auto const in = *Tape::open(common::canonicalize("../tests/test_input2.tape"), config);
+    auto const out = *Tape::open(path, config);
+    auto sort = *algorithm::detail::CheckpointedSort<Tape, Tape>::open(*in, *out, dir, false, 4);
+    // the process dies in the middle of run generation
+    for(auto i = 0; i < 25; ++i)
+      ASSERT_TRUE(sort.step());
+    consumed = sort.manifest().consumed;
+  }
+  // a run that was being written when the process died
+  std::ofstream(dir / "orphan.run", std::ios::binary) << "partial";
+  {
+    auto const in = *Tape::open(common::canonicalize("../tests/test_input2.tape"), config);
+    auto const out = *Tape::open(path, config);
+    auto sort = *algorithm::detail::CheckpointedSort<Tape, Tape>::open(*in, *out, dir, true, 4);
+    ASSERT_EQ(sort.manifest().consumed, consumed);
+    ASSERT_FALSE(std::filesystem::exists(dir / "orphan.run"));
+    // and again in the middle of a merge pass
+    for(auto i = 0; i < 17; ++i)
+      ASSERT_TRUE(*sort.step());
+    ASSERT_EQ(in->stats().reads, in->size() - consumed);
+  }
+  ASSERT_GT(Manifest::load(dir)->pass, 0);
+  auto const runs_in = [&](std::filesystem::path const& at) {
+    return std::ranges::count_if(std::filesystem::directory_iterator(at), [](auto const& entry) { return entry.path().extension() == ".run"; });
+  };
+  {
+    // a fresh sort in the same directory drops the runs of the interrupted one
+    auto const other = dir / "fresh";
+    std::filesystem::create_directories(other);
+    for(auto const& entry : std::filesystem::directory_iterator(dir))
+      if(entry.is_regular_file() and entry.path().filename() != "out.tape")
+        std::filesystem::copy(entry.path(), other / entry.path().filename());
+    ASSERT_GT(runs_in(other), 0);
+    auto const in = *Tape::open(common::canonicalize("../tests/test_input2.tape"), config);
+    auto const out = *Tape::open(other / "out.tape", config);
+    auto const sort = *algorithm::detail::CheckpointedSort<Tape, Tape>::open(*in, *out, other, false, 4);
+    ASSERT_EQ(runs_in(other), 0);
+    ASSERT_EQ(sort.manifest().consumed, 0);
+  }
+  std::filesystem::remove_all(dir / "fresh");
+  {
+    auto const in = *Tape::open(common::canonicalize("../tests/test_input2.tape"), config);
+    auto const out = *Tape::open(path, config);
+    ASSERT_TRUE(sort_checkpointed_into(*in, *out, dir, true));
+    ASSERT_EQ(in->stats().reads, 0);
+  }
+  ASSERT_FALSE(std::filesystem::exists(dir / Manifest::filename));
+  auto const out = *BinaryTape<int32_t>::create(path, config);
+  auto const ref = *BinaryTape<int32_t>::create(common::canonicalize("../tests/test_output2.tape"), config);
+  ASSERT_EQ(out->size(), ref->size());
+  for(std::size_t i = 0; i < ref->size(); ++i)
+    ASSERT_EQ(out->read_and_shift(), ref->read_and_shift());
+  std::filesystem::remove_all(dir);
+}
+#endif
@@ -78,7 +78,7 @@ namespace yuliy_test_task::common
    *
    * @throws None.
    */
-  inline auto print_progress(int current, int total) -> void {
+  inline auto print_progress(std::size_t current, std::size_t total) -> void {
     auto const percent = static_cast<double>(current) / static_cast<double>(total) * 100.0;
     std::cout << "\r\033[2K" << std::format("Progress: \033[1;32m{:>5.2f}%\033[0m (\033[0;34m{}/{}\033[0m)", percent, current, total);
   }
@@ -1,40 +1,171 @@
 #include <impl/config.hh>
 
+#include <algorithm>
+#include <array>
 #include <fstream>
+#include <map>
+#include <ranges>
+#include <stdexcept>
+#include <utility>
 #include <impl/common.hh>
 
 namespace yuliy_test_task
 {
+  auto to_string(DelayMode mode) -> std::string_view {
+    switch(mode) {
+      case DelayMode::Virtual: return "virtual";
+      case DelayMode::None: return "none";
+      case DelayMode::Real: break;
+    }
+    return "real";
+  }
+
+  auto to_string(TapeRole role) -> std::string_view {
+    switch(role) {
+      case TapeRole::Output: return "output";
+      case TapeRole::Scratch: return "scratch";
+      case TapeRole::Input: break;
+    }
+    return "input";
+  }
+
   auto Config::from_pwd() -> std::expected<Config, std::string> {
     return Config::load(std::filesystem::current_path() / Config::default_filename);
   }
 
+  auto Config::set_device(std::string const& key, std::string const& value) -> bool {
+    if(key == "read_delay")
+      this->read_delay_ = std::chrono::microseconds{std::stoll(value)};
+    else if(key == "write_delay")
+      this->write_delay_ = std::chrono::microseconds{std::stoll(value)};
+    else if(key == "tape_shift_delay")
+      this->tape_shift_delay_ = std::chrono::microseconds{std::stoll(value)};
+    else if(key == "tape_rewind_delay")
+      this->tape_rewind_delay_ = std::chrono::microseconds{std::stoll(value)};
+    else if(key == "block_size")
+      this->block_size_ = std::stoull(value);
+    else if(key == "stream_rate")
+      this->stream_settings_.bytes_per_us = std::stoull(value);
+    else if(key == "stream_window")
+      this->stream_settings_.window = std::chrono::microseconds{std::stoll(value)};
+    else if(key == "start_stop_penalty")
+      this->stream_settings_.start_stop_penalty = std::chrono::microseconds{std::stoll(value)};
+    else if(key == "locate_delay")
+      this->stream_settings_.locate_delay = std::chrono::microseconds{std::stoll(value)};
+    else
+      return false;
+    return true;
+  }
+
+  auto Config::finish_device() -> void {
+    if(this->stream_settings_.bytes_per_us == 0)
+      this->streaming_.reset();
+    else
+      this->streaming_ = this->stream_settings_;
+  }
+
+  auto Config::device(TapeRole role) const -> Config const& {
+    auto const devices = this->devices_ ? this->devices_ : this->sibling_devices_.lock();
+    return devices ? (*devices)[static_cast<std::size_t>(role)] : *this;
+  }
+
   auto Config::load(const std::filesystem::path &path) -> std::expected<Config, std::string> {
     if(not exists(path))
       return std::unexpected(std::format("file {} doesn't exist", path.generic_string()));
     auto ifs = std::ifstream(path);
     auto self = Config();
+    auto const roles = std::array { TapeRole::Input, TapeRole::Output, TapeRole::Scratch };
+    auto assigned = std::array<std::string, roles.size()>();
+    auto profiles = std::map<std::string, std::vector<std::pair<std::string, std::string>>>();
+    auto section = std::string();
     try {
       for(std::string line; std::getline(ifs, line);) {
+        if(auto const name = common::trimmed(line); name.starts_with('[') and name.ends_with(']')) {
+          section = name.substr(1, name.size() - 2);
+          profiles[section];
+          continue;
+        }
         auto pos = line.find('=');
         if(pos == std::string::npos)
           continue;
         auto key = common::trimmed(line.substr(0, pos));
         auto value = common::trimmed(line.substr(pos + 1));
-        if(key == "ram_limit")
+        if(not section.empty())
+          profiles[section].emplace_back(std::move(key), std::move(value));
+        else if(key == "ram_limit")
           self.ram_limit_ = std::stoull(value);
-        else if(key == "read_delay")
-          self.read_delay_ = std::chrono::microseconds{std::stoll(value)};
-        else if(key == "write_delay")
-          self.write_delay_ = std::chrono::microseconds{std::stoll(value)};
-        else if(key == "tape_shift_delay")
-          self.tape_shift_delay_ = std::chrono::microseconds{std::stoll(value)};
-        else if(key == "tape_rewind_delay")
-          self.tape_rewind_delay_ = std::chrono::microseconds{std::stoll(value)};
+        else if(key == "delay_mode") {
+          if(value == "real")
+            self.delay_mode_ = DelayMode::Real;
+          else if(value == "virtual")
+            self.delay_mode_ = DelayMode::Virtual;
+          else if(value == "none")
+            self.delay_mode_ = DelayMode::None;
+          else
+            throw std::invalid_argument(value);
+        } else if(key == "huge_pages")
+          self.huge_pages_ = std::stoull(value) != 0;
+        else if(key == "scratch_ram_limit")
+          self.scratch_ram_limit_ = std::stoull(value);
+        else if(key == "scratch_memfd_limit")
+          self.scratch_memfd_limit_ = std::stoull(value);
+        else if(key == "scratch_dirs") {
+          self.scratch_dirs_.clear();
+          for(auto const dir : std::views::split(value, ','))
+            if(not dir.empty())
+              self.scratch_dirs_.emplace_back(std::string_view(dir));
+        } else if(key == "scratch_pool_files")
+          self.scratch_pool_files_ = std::stoull(value);
+        else if(key == "scratch_extent")
+          self.scratch_extent_ = std::stoull(value);
+        else if(key == "scratch_placement") {
+          if(value == to_string(ScratchPlacement::RoundRobin))
+            self.scratch_placement_ = ScratchPlacement::RoundRobin;
+          else if(value == to_string(ScratchPlacement::FreeSpace))
+            self.scratch_placement_ = ScratchPlacement::FreeSpace;
+          else
+            throw std::invalid_argument(value);
+        }
+        else if(not self.set_device(key, value))
+          for(auto const role : roles)
+            if(key == std::format("{}_profile", to_string(role)))
+              assigned[static_cast<std::size_t>(role)] = value;
       }
     } catch(...) {
       return std::unexpected(std::format(R"(failed to parse config file '{}')", path.generic_string()));
     }
+    self.finish_device();
+    self.budget_ = std::make_shared<MemoryBudget>(self.ram_limit_, self.huge_pages_);
+    if(self.scratch_dirs_.empty())
+      self.scratch_dirs_.push_back(std::filesystem::temp_directory_path() / "yuliy_test_task_temp_file_sorter");
+    self.scratch_ = std::make_shared<ScratchSpace>(self.scratch_ram_limit_, self.scratch_memfd_limit_,
+      self.scratch_dirs_, self.scratch_placement_, self.scratch_pool_files_, self.scratch_extent_);
+    if(std::ranges::all_of(assigned, &std::string::empty))
+      return self;
+
+    auto devices = std::make_shared<std::vector<Config>>(roles.size(), self);
+    for(auto const role : roles) {
+      auto& device = (*devices)[static_cast<std::size_t>(role)];
+      device.sibling_devices_ = devices;
+      auto const& name = assigned[static_cast<std::size_t>(role)];
+      if(name.empty())
+        continue;
+      auto const profile = profiles.find(name);
+      if(profile == profiles.end())
+        return std::unexpected(std::format(R"(config file '{}' assigns unknown profile '{}' to the {} tape)",
+          path.generic_string(), name, to_string(role)));
+      try {
+        for(auto const& [key, value] : profile->second)
+          if(not device.set_device(key, value))
+            return std::unexpected(std::format(R"(profile '{}' of config file '{}' sets '{}', which is not a device setting)",
+              name, path.generic_string(), key));
+      } catch(...) {
+        return std::unexpected(std::format(R"(failed to parse profile '{}' of config file '{}')", name, path.generic_string()));
+      }
+      device.profile_ = name;
+      device.finish_device();
+    }
+    self.devices_ = std::move(devices);
     return self;
   }
 
@@ -44,6 +175,26 @@ namespace yuliy_test_task
     os << std::format("write delay  = {}\n", self.write_delay_);
     os << std::format("tape shift   = {}\n", self.tape_shift_delay_);
     os << std::format("tape rewind  = {}\n", self.tape_rewind_delay_);
+    if(self.block_size_ != 0)
+      os << std::format("block size   = {} bytes\n", self.block_size_);
+    if(auto const& model = self.streaming_)
+      os << std::format("streaming    = {} B/µs, window {}, start/stop {}, locate {}\n",
+        model->bytes_per_us, model->window, model->start_stop_penalty, model->locate_delay);
+    os << std::format("delay mode   = {}\n", to_string(self.delay_mode_));
+    os << std::format("huge pages   = {}\n", self.huge_pages_);
+    if(self.scratch_ram_limit_ != 0 or self.scratch_memfd_limit_ != 0)
+      os << std::format("scratch      = {} bytes in ram, {} bytes in memfd, then disk\n",
+        self.scratch_ram_limit_, self.scratch_memfd_limit_);
+    if(self.scratch_dirs_.size() > 1)
+      for(auto const& dir : self.scratch_dirs_)
+        os << std::format("scratch dir  = {} ({})\n", dir.generic_string(), to_string(self.scratch_placement_));
+    if(self.devices_)
+      for(auto const& device : *self.devices_)
+        if(not device.profile_.empty())
+          os << std::format("{:<12} = profile {}: read {}, write {}, shift {}, rewind {}{}\n",
+            std::format("{} tape", to_string(static_cast<TapeRole>(&device - self.devices_->data()))), device.profile_,
+            device.read_delay_, device.write_delay_, device.tape_shift_delay_, device.tape_rewind_delay_,
+            device.streaming_ ? std::format(", streaming {} B/µs", device.streaming_->bytes_per_us) : std::string());
     return os;
   }
 } // namespace yuliy_test_task
\ No newline at end of file
@@ -7,10 +7,56 @@
 #include <string_view>
 #include <format>
 #include <sstream>
+#include <memory>
+#include <optional>
+#include <vector>
+#include <impl/memory.hh>
+#include <impl/scratch.hh>
 
 namespace yuliy_test_task
 {
   using namespace std::chrono_literals;
+
+  /**
+   * How tapes pay the configured delays.
+   */
+  enum class DelayMode
+  {
+    Real,     ///< sleep for every delay
+    Virtual,  ///< advance a virtual clock instead of sleeping
+    None      ///< ignore the delays
+  };
+
+  [[nodiscard]] auto to_string(DelayMode mode) -> std::string_view;
+
+  /**
+   * What a tape is used for, to find the device it lives on.
+   */
+  enum class TapeRole
+  {
+    Input,    ///< the tape being sorted
+    Output,   ///< the tape receiving the sorted values
+    Scratch   ///< the temporary tapes of a sort
+  };
+
+  [[nodiscard]] auto to_string(TapeRole role) -> std::string_view;
+
+  /**
+   * The cost of a drive that is fast while it streams and slow to start and stop.
+   *
+   * Values are transferred at `bytes_per_us`. A transfer that comes more than
+   * `window` after the previous one finds the drive stopped and pays
+   * `start_stop_penalty` to reposition it, and one in the other direction pays
+   * `locate_delay`.
+   */
+  struct StreamingModel
+  {
+    std::size_t bytes_per_us = 0;
+    std::chrono::microseconds window = 0us;
+    std::chrono::microseconds start_stop_penalty = 0us;
+    std::chrono::microseconds locate_delay = 0us;
+  };
+
   class Config
   {
     public:
@@ -27,7 +73,7 @@ namespace yuliy_test_task
        * @return The maximum number of elements of type T that can fit within the configured RAM limit.
        */
       template <typename T>
-      constexpr auto ram_limit_elems() const noexcept -> T {
+      constexpr auto ram_limit_elems() const noexcept -> std::size_t {
         return this->ram_limit_ / sizeof(T);
       }
 
@@ -66,16 +112,120 @@ namespace yuliy_test_task
        */
       [[nodiscard]] constexpr auto tape_rewind_delay() const noexcept -> std::chrono::microseconds { return this->tape_rewind_delay_; }
 
+      /**
+       * Returns the size of the blocks tapes transfer.
+       *
+       * @return The block size in bytes, 0 if tapes transfer single values.
+       */
+      [[nodiscard]] constexpr auto block_size() const noexcept -> std::size_t { return this->block_size_; }
+
+      /**
+       * Returns the streaming cost model of the tapes.
+       *
+       * @return The model if `stream_rate` is configured, otherwise `std::nullopt`
+       * and every operation is charged its flat delay.
+       */
+      [[nodiscard]] constexpr auto streaming() const noexcept -> std::optional<StreamingModel> const& { return this->streaming_; }
+
+      /**
+       * Returns how tapes pay the configured delays.
+       *
+       * @return The configured delay mode.
+       */
+      [[nodiscard]] constexpr auto delay_mode() const noexcept -> DelayMode { return this->delay_mode_; }
+
+      /**
+       * Returns whether the memory arena should be backed by huge pages.
+       *
+       * @return `true` if huge pages were requested, `false` otherwise.
+       */
+      [[nodiscard]] constexpr auto huge_pages() const noexcept -> bool { return this->huge_pages_; }
+
+      /**
+       * Returns the memory budget that enforces the RAM limit.
+       *
+       * Copies of a configuration share the same budget.
+       *
+       * @return The memory budget of the configured RAM limit.
+       */
+      [[nodiscard]] auto budget() const noexcept -> MemoryBudget& { return *this->budget_; }
+
+      /**
+       * Returns the tiered storage of temporary runs.
+       *
+       * Runs are kept in memory up to `scratch_ram_limit` bytes, then in memfd files
+       * up to `scratch_memfd_limit` bytes, then on disk. Both limits are 0 unless
+       * configured, so runs go to disk. On disk, runs are spread over the
+       * comma-separated `scratch_dirs` as `scratch_placement` says, `round_robin`
+       * or `free_space`; up to `scratch_pool_files` files are kept for reuse and
+       * are preallocated in extents of `scratch_extent` bytes. Copies of a
+       * configuration share the space.
+       *
+       * @return The scratch space.
+       */
+      [[nodiscard]] auto scratch() const noexcept -> ScratchSpace& { return *this->scratch_; }
+
+      /**
+       * Returns the configuration of the device that tapes of a role live on.
+       *
+       * A `[name]` section of the configuration file is a device profile: it
+       * overrides the delays, the block size and the streaming model of the
+       * settings above the first section. `input_profile`, `output_profile` and
+       * `scratch_profile` assign profiles to the roles. Devices share the RAM
+       * limit, the delay mode and the memory budget, and can be asked for the
+       * devices of the other roles.
+       *
+       * @param role The role of the tape.
+       * @return The configuration of the device, this one if no profile is assigned.
+       */
+      [[nodiscard]] auto device(TapeRole role) const -> Config const&;
+
+      /**
+       * Returns the name of the device profile this configuration was made from.
+       *
+       * @return The profile name, empty if no profile was applied.
+       */
+      [[nodiscard]] auto profile() const noexcept -> std::string const& { return this->profile_; }
+
       friend auto operator<<(std::ostream& os, Config const& self) -> std::ostream&;
 
     private:
       Config() = default;
 
+      /**
+       * Applies a setting of a tape device.
+       *
+       * @return `true` if the key is a device setting, `false` otherwise.
+       * @throws std::exception If the value cannot be parsed.
+       */
+      auto set_device(std::string const& key, std::string const& value) -> bool;
+
+      /**
+       * Enables the streaming model if a stream rate was set.
+       */
+      auto finish_device() -> void;
+
       std::size_t ram_limit_ = 1024 * 1024 * 1024;
       std::chrono::microseconds read_delay_ = 2us;
       std::chrono::microseconds write_delay_ = 2us;
       std::chrono::microseconds tape_shift_delay_ = 10us;
       std::chrono::microseconds tape_rewind_delay_ = 100us;
+      std::size_t block_size_ = 0;
+      std::optional<StreamingModel> streaming_;
+      StreamingModel stream_settings_ = { .bytes_per_us = 0, .window = 1000us, .start_stop_penalty = 0us, .locate_delay = 0us };
+      DelayMode delay_mode_ = DelayMode::Real;
+      bool huge_pages_ = false;
+      std::shared_ptr<MemoryBudget> budget_;
+      std::size_t scratch_ram_limit_ = 0;
+      std::size_t scratch_memfd_limit_ = 0;
+      std::vector<std::filesystem::path> scratch_dirs_;
+      ScratchPlacement scratch_placement_ = ScratchPlacement::RoundRobin;
+      std::size_t scratch_pool_files_ = 64;
+      std::size_t scratch_extent_ = std::size_t(1) << 20;
+      std::shared_ptr<ScratchSpace> scratch_;
+      std::string profile_;
+      std::shared_ptr<std::vector<Config>> devices_;      // one per role, owned by the loaded configuration
+      std::weak_ptr<std::vector<Config>> sibling_devices_; // the devices, seen from one of them
   };
 } // namespace yuliy_test_task
 
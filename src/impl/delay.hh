@@ -0,0 +1,211 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <concepts>
+#include <algorithm>
+#include <array>
+#include <thread>
+#include <impl/common.hh>
+#if defined __x86_64__ or defined __i386__
+#include <immintrin.h>
+#endif
+
+namespace yuliy_test_task
+{
+  using namespace std::chrono_literals;
+
+  /**
+   * Pays microsecond delays accurately.
+   *
+   * `sleep_for` overshoots short delays by the timer slack and the wakeup latency
+   * of the scheduler, tens of microseconds, so sleeping for every tape operation
+   * is both slow and wrong. Instead, every thread accumulates the delays it is
+   * charged as a debt and pays it once it reaches a quantum: it sleeps for the
+   * part of the debt that the calibrated sleep overshoot cannot spoil and spins
+   * with a pause instruction for the rest. Time overpaid is credited against the
+   * next debt, so the delays are honoured in aggregate.
+   *
+   * The requested and paid totals of all threads are kept, to report the error
+   * of the emulation.
+   */
+  class DelayEngine
+  {
+    public:
+      using clock = std::chrono::steady_clock;
+
+      /**
+       * The debt below which delays are only accumulated.
+       */
+      static constexpr auto quantum = std::chrono::nanoseconds(20us);
+
+      /**
+       * Charges a delay to the calling thread, paying the debt if it reached the quantum.
+       *
+       * @param duration The delay.
+       */
+      static auto pay(std::chrono::nanoseconds duration) -> void {
+        if(duration <= 0ns)
+          return;
+        requested_.fetch_add(duration.count(), std::memory_order_relaxed);
+        auto& debt = local();
+        debt.pending += duration;
+        if(debt.pending >= quantum)
+          debt.settle();
+      }
+
+      /**
+       * Pays the whole debt of the calling thread, however small.
+       */
+      static auto settle() -> void { local().settle(); }
+
+      /**
+       * Returns the sum of the delays charged so far.
+       *
+       * @return The requested time.
+       */
+      [[nodiscard]] static auto requested() noexcept -> std::chrono::nanoseconds {
+        return std::chrono::nanoseconds(requested_.load(std::memory_order_relaxed));
+      }
+
+      /**
+       * Returns the time spent paying delays so far.
+       *
+       * @return The measured time.
+       */
+      [[nodiscard]] static auto paid() noexcept -> std::chrono::nanoseconds {
+        return std::chrono::nanoseconds(paid_.load(std::memory_order_relaxed));
+      }
+
+      /**
+       * Returns how much a short sleep overshoots on this machine, measured on first use.
+       *
+       * @return The median overshoot of a 1µs sleep.
+       */
+      [[nodiscard]] static auto sleep_overshoot() -> std::chrono::nanoseconds {
+        static auto const overshoot = [] {
+          auto samples = std::array<std::chrono::nanoseconds, 9>();
+          for(auto& sample : samples) {
+            auto const start = clock::now();
+            std::this_thread::sleep_for(1us);
+            sample = clock::now() - start - 1us;
+          }
+          std::ranges::nth_element(samples, samples.begin() + samples.size() / 2);
+          return std::max(0ns, samples[samples.size() / 2]);
+        }();
+        return overshoot;
+      }
+
+    private:
+      struct Debt
+      {
+        std::chrono::nanoseconds pending = 0ns;
+
+        ~Debt() { this->settle(); }
+
+        auto settle() -> void {
+          if(this->pending <= 0ns)
+            return;
+          auto const start = clock::now();
+          auto const deadline = start + this->pending;
+          if(auto const overshoot = sleep_overshoot(); this->pending > overshoot)
+            std::this_thread::sleep_for(this->pending - overshoot);
+          auto now = clock::now();
+          for(; now < deadline; now = clock::now())
+            relax();
+          auto const spent = std::chrono::duration_cast<std::chrono::nanoseconds>(now - start);
+          paid_.fetch_add(spent.count(), std::memory_order_relaxed);
+          this->pending -= spent;
+        }
+      };
+
+      static auto relax() noexcept -> void {
+#if defined __x86_64__ or defined __i386__
+        _mm_pause();
+#else
+        std::this_thread::yield();
+#endif
+      }
+
+      static auto local() -> Debt& {
+        thread_local auto debt = Debt();
+        return debt;
+      }
+
+      static inline std::atomic<std::chrono::nanoseconds::rep> requested_ = 0;
+      static inline std::atomic<std::chrono::nanoseconds::rep> paid_ = 0;
+  };
+
+  /**
+   * The way a tape pays the delays of its operations.
+   */
+  template <typename D>
+  concept DelayPolicy = std::default_initializable<D>
+    and requires(D d, std::chrono::nanoseconds duration) {
+      { d(duration) } -> std::same_as<void>;
+    };
+
+  /**
+   * Waits for every delay with the `DelayEngine`, so an emulated tape runs at the
+   * speed of a real one.
+   */
+  struct RealDelay
+  {
+    auto operator()(std::chrono::nanoseconds duration) const -> void {
+      DelayEngine::pay(duration);
+    }
+  };
+
+  /**
+   * Advances a process-wide virtual clock by every delay instead of sleeping.
+   *
+   * The clock adds up the time the tapes would have spent, so experiments report
+   * the emulated time while the files are read and written at full speed.
+   */
+  struct VirtualDelay
+  {
+    auto operator()(std::chrono::nanoseconds duration) const noexcept -> void {
+      clock_.fetch_add(duration.count(), std::memory_order_relaxed);
+    }
+
+    /**
+     * Returns the virtual time that has passed.
+     *
+     * @return The sum of all delays charged so far.
+     */
+    [[nodiscard]] static auto now() noexcept -> std::chrono::nanoseconds {
+      return std::chrono::nanoseconds(clock_.load(std::memory_order_relaxed));
+    }
+
+   private:
+    static inline std::atomic<std::chrono::nanoseconds::rep> clock_ = 0;
+  };
+
+  /**
+   * Ignores every delay. The call is empty, so it is compiled out.
+   */
+  struct NoDelay
+  {
+    constexpr auto operator()(std::chrono::nanoseconds) const noexcept -> void {}
+  };
+} // namespace yuliy_test_task
+
+#if defined UNIT_TESTS
+#include <gtest/gtest.h>
+
+TEST(Delay, engine_pays_small_delays_in_aggregate)
+{
+  using namespace yuliy_test_task;
+  auto const requested = DelayEngine::requested();
+  auto const start = DelayEngine::clock::now();
+  for(auto i = 0; i < 2000; ++i)
+    DelayEngine::pay(1us);
+  DelayEngine::settle();
+  auto const wall = DelayEngine::clock::now() - start;
+  ASSERT_EQ(DelayEngine::requested() - requested, 2000us);
+  // earlier tests may have left the thread a credit of at most one overshoot
+  ASSERT_GE(wall, 2000us - DelayEngine::quantum - 2 * DelayEngine::sleep_overshoot());
+  // a sleep per delay would take over a hundred milliseconds
+  ASSERT_LT(wall, 20ms);
+}
+#endif
@@ -0,0 +1,426 @@
+#pragma once
+
+#include <bit>
+#include <limits>
+#include <vector>
+#include <span>
+#include <optional>
+#include <concepts>
+#include <cstdint>
+#include <algorithm>
+#include <impl/itape.hh>
+#include <impl/common.hh>
+#include <impl/writer.hh>
+#include <impl/sort.hh>
+#include <impl/sample.hh>
+
+namespace yuliy_test_task::algorithm
+{
+  namespace detail
+  {
+    /**
+     * The largest number of buckets a distribution pass scatters into.
+     */
+    inline constexpr std::size_t max_distribution_buckets = 256;
+
+    /**
+     * The smallest RAM limit in elements a distribution fits in: two write-behind
+     * blocks, an input chunk and the write buffers of two buckets, one element each.
+     */
+    inline constexpr std::size_t min_distribution_elems = 5;
+
+    /**
+     * Calculates the number of buckets a distribution pass can afford.
+     *
+     * Half of the RAM limit is shared by the write buffers of the buckets, and
+     * the number of buckets is chosen so that each of them gets at least
+     * `min_cursor_block_elems` elements where the limit allows it.
+     *
+     * \param max_elems_in_ram The RAM limit in elements.
+     * \returns A power of two between 2 and `max_distribution_buckets`.
+     */
+    [[nodiscard]] constexpr auto distribution_buckets(std::size_t max_elems_in_ram) -> std::size_t {
+      auto const affordable = std::max<std::size_t>(2, max_elems_in_ram / 2 / min_cursor_block_elems);
+      return std::min(max_distribution_buckets, std::bit_floor(affordable));
+    }
+
+    /**
+     * A contiguous range of keys, measured as offsets from the smallest key of the tape.
+     */
+    struct KeySpan
+    {
+      std::uint64_t base;
+      std::uint64_t width;
+    };
+
+    template <std::integral T>
+    [[nodiscard]] constexpr auto key_offset(T value, T lo) -> std::uint64_t {
+      return static_cast<std::uint64_t>(static_cast<std::int64_t>(value) - static_cast<std::int64_t>(lo));
+    }
+
+    /**
+     * The input tape as a distribution source that rejects keys outside the given range.
+     */
+    template <std::integral T>
+    struct CheckedTapeSource
+    {
+      ITape<T>& tape;
+      T lo;
+      T hi;
+      std::size_t size;
+      bool progress;
+      std::size_t consumed = 0;
+      std::optional<std::string> error;
+
+      [[nodiscard]] auto read_n(std::span<T> values) -> std::size_t {
+        auto const n = this->tape.read_and_shift_n(values);
+        if(not n) {
+          this->error = std::move(n.error());
+          return 0;
+        }
+        for(auto const value : values.first(*n))
+          if(value < this->lo or this->hi < value) {
+            this->error = std::format("key {} is outside [{}, {}]", value, this->lo, this->hi);
+            return 0;
+          }
+        this->consumed += *n;
+        if(this->progress)
+          common::print_progress(this->consumed, this->size);
+        return *n;
+      }
+    };
+
+    template <std::integral T, typename Source, typename Sink>
+    requires (sizeof(T) <= sizeof(std::uint32_t))
+    [[nodiscard]] auto distribute(
+      Source& source,
+      std::size_t size,
+      KeySpan span,
+      T lo,
+      Sink& sink,
+      std::size_t max_elems_in_ram,
+      TapeStats* scratch,
+      ScratchSpace& space,
+      MemoryBudget* budget
+    ) -> result_type<void>;
+
+    /**
+     * Scatters the keys that arrive from `source` into the given buckets and sorts
+     * every bucket into the sink.
+     *
+     * Keys are written into bucket runs with plain sequential appends. Every bucket
+     * that fits in a quarter of the RAM limit is then sorted in RAM, a bucket whose
+     * span holds a single key is copied as is, and any other bucket is distributed
+     * again on the high bits of its span.
+     *
+     * \param source Provides the keys with `read_n`, like a `RunCursor` source.
+     * \param size The number of keys `source` will provide.
+     * \param buckets The disjoint, increasing key spans of the buckets.
+     * \param bucket_of Maps a key to the index of its bucket.
+     * \param lo The smallest key of the tape, the origin of the offsets.
+     * \param sink The destination of the sorted keys.
+     * \param max_elems_in_ram The RAM limit in elements.
+     * \param scratch If not null, receives the operations performed on bucket runs.
+     * \param space The scratch space the bucket runs are kept in.
+     * \param budget The memory budget the buffers are charged to, if any.
+     */
+    template <std::integral T, typename Source, typename BucketOf, typename Sink>
+    requires (sizeof(T) <= sizeof(std::uint32_t))
+    [[nodiscard]] auto distribute_into_buckets(
+      Source& source,
+      std::size_t size,
+      std::span<KeySpan const> buckets,
+      BucketOf&& bucket_of,
+      T lo,
+      Sink& sink,
+      std::size_t max_elems_in_ram,
+      TapeStats* scratch,
+      ScratchSpace& space,
+      MemoryBudget* budget
+    ) -> result_type<void> {
+      auto const used = buckets.size();
+      auto const block = std::max<std::size_t>(1, max_elems_in_ram / 2 / used);
+      auto const alloc = BudgetAllocator<T>(budget);
+
+      auto runs = std::vector<TempFile<T>>();
+      runs.reserve(used);
+      for(std::size_t b = 0; b < used; ++b)
+        runs.emplace_back(space);
+      auto sizes = std::vector<std::size_t>(used);
+      auto buffers = std::vector<budget_vector<T>>(used, budget_vector<T>(alloc));
+      for(auto& buffer : buffers)
+        buffer.reserve(block);
+      auto chunk = budget_vector<T>(std::max<std::size_t>(1, max_elems_in_ram / 8), alloc);
+      for(std::size_t consumed = 0; consumed < size;) {
+        auto const n = source.read_n(std::span<T>(chunk).first(std::min(chunk.size(), size - consumed)));
+        if(n == 0)
+          break;
+        consumed += n;
+        for(auto const value : std::span<T const>(chunk).first(n)) {
+          auto const b = static_cast<std::size_t>(bucket_of(value));
+          auto& buffer = buffers[b];
+          buffer.push_back(value);
+          if(buffer.size() < block)
+            continue;
+          if(auto const res = runs[b].write_and_shift_n(buffer); not res)
+            return std::unexpected(res.error());
+          sizes[b] += buffer.size();
+          buffer.clear();
+        }
+      }
+      for(std::size_t b = 0; b < used; ++b) {
+        if(auto const res = runs[b].write_and_shift_n(buffers[b]); not res)
+          return std::unexpected(res.error());
+        sizes[b] += buffers[b].size();
+        buffers[b] = budget_vector<T>(alloc);
+        runs[b].rewind();
+      }
+      chunk = budget_vector<T>(alloc);
+
+      for(std::size_t b = 0; b < used; ++b) {
+        auto& run = runs[b];
+        if(sizes[b] <= max_elems_in_ram / 4) {
+          auto values = budget_vector<T>(sizes[b], alloc);
+          values.resize(run.read_n(values));
+          std::sort(values.begin(), values.end());
+          sink.push(std::span<T const>(values));
+        } else if(buckets[b].width == 1) {
+          auto values = budget_vector<T>(std::max<std::size_t>(1, max_elems_in_ram / 8), alloc);
+          for(auto n = run.read_n(values); n > 0; n = run.read_n(values))
+            sink.push(std::span<T const>(values).first(n));
+        } else {
+          auto const res = distribute<T>(run, sizes[b], buckets[b], lo, sink, max_elems_in_ram, scratch, space, budget);
+          if(not res)
+            return res;
+        }
+        if(scratch)
+          *scratch += run.stats;
+        // the bucket is sorted, its file can be reused by the next one
+        run = TempFile<T>(space);
+      }
+      return {};
+    }
+
+    /**
+     * Sorts the keys of one span that arrive from `source` into the sink, bucketing
+     * them by their high bits within the span.
+     *
+     * \param source Provides the keys with `read_n`, like a `RunCursor` source.
+     * \param size The number of keys `source` will provide.
+     * \param span The key span the keys belong to.
+     * \param lo The smallest key of the tape, the origin of the offsets.
+     * \param sink The destination of the sorted keys.
+     * \param max_elems_in_ram The RAM limit in elements.
+     * \param scratch If not null, receives the operations performed on bucket runs.
+     * \param space The scratch space the bucket runs are kept in.
+     * \param budget The memory budget the buffers are charged to, if any.
+     */
+    template <std::integral T, typename Source, typename Sink>
+    requires (sizeof(T) <= sizeof(std::uint32_t))
+    [[nodiscard]] auto distribute(
+      Source& source,
+      std::size_t size,
+      KeySpan span,
+      T lo,
+      Sink& sink,
+      std::size_t max_elems_in_ram,
+      TapeStats* scratch,
+      ScratchSpace& space,
+      MemoryBudget* budget
+    ) -> result_type<void> {
+      auto const bits = static_cast<std::size_t>(std::bit_width(span.width - 1));
+      auto const bucket_bits = static_cast<std::size_t>(std::countr_zero(distribution_buckets(max_elems_in_ram)));
+      auto const shift = bits > bucket_bits ? bits - bucket_bits : 0;
+      auto buckets = std::vector<KeySpan>(static_cast<std::size_t>(((span.width - 1) >> shift) + 1));
+      for(std::size_t b = 0; b < buckets.size(); ++b) {
+        auto const offset = static_cast<std::uint64_t>(b) << shift;
+        buckets[b] = KeySpan { .base = span.base + offset, .width = std::min(std::uint64_t(1) << shift, span.width - offset) };
+      }
+      return distribute_into_buckets<T>(source, size, std::span<KeySpan const>(buckets), [&](T value) {
+        return (key_offset(value, lo) - span.base) >> shift;
+      }, lo, sink, max_elems_in_ram, scratch, space, budget);
+    }
+
+    /**
+     * Sorts the keys that arrive from `source` into the sink, bucketing them by the
+     * given splitters.
+     *
+     * Bucket `i` holds the keys in `(splitters[i - 1], splitters[i]]`, the first and
+     * the last buckets are bounded by `lo` and `hi`. Buckets that turn out too big
+     * are distributed further by their high bits.
+     *
+     * \param splitters Strictly increasing keys in `[lo, hi)`.
+     */
+    template <std::integral T, typename Source, typename Sink>
+    requires (sizeof(T) <= sizeof(std::uint32_t))
+    [[nodiscard]] auto distribute_by_splitters(
+      Source& source,
+      std::size_t size,
+      std::span<T const> splitters,
+      T lo,
+      T hi,
+      Sink& sink,
+      std::size_t max_elems_in_ram,
+      TapeStats* scratch,
+      ScratchSpace& space,
+      MemoryBudget* budget
+    ) -> result_type<void> {
+      auto buckets = std::vector<KeySpan>();
+      buckets.reserve(splitters.size() + 1);
+      auto base = std::uint64_t(0);
+      for(auto const splitter : splitters) {
+        auto const end = key_offset(splitter, lo) + 1;
+        buckets.push_back(KeySpan { .base = base, .width = end - base });
+        base = end;
+      }
+      buckets.push_back(KeySpan { .base = base, .width = key_offset(hi, lo) + 1 - base });
+      return distribute_into_buckets<T>(source, size, std::span<KeySpan const>(buckets), [&](T value) {
+        return std::ranges::lower_bound(splitters, value) - splitters.begin();
+      }, lo, sink, max_elems_in_ram, scratch, space, budget);
+    }
+  } // namespace detail
+
+
+  /**
+   * Sorts the input tape with an external MSD radix distribution.
+   *
+   * Instead of sorting runs and merging them, the input is scattered by the high
+   * bits of its keys into bucket runs in one pass. The buckets cover disjoint,
+   * increasing key ranges, so each one is sorted on its own — in RAM when it is
+   * small enough, otherwise by distributing it again — and appended to the output
+   * tape in order. No merge is needed.
+   *
+   * When the key range is not known, pass the whole domain of T; keys that only
+   * use a small part of it then cost extra levels of distribution.
+   *
+   * \param in The input tape.
+   * \param out The output tape.
+   * \param lo The smallest key on the tape.
+   * \param hi The largest key on the tape.
+   * \param progress If true, the function prints progress information.
+   * \param scratch If not null, receives the operations performed on bucket runs.
+   * \returns An empty result if the function was successful, otherwise
+   * an std::unexpected with an error message.
+   */
+  template <std::integral T>
+  requires (sizeof(T) <= sizeof(std::uint32_t))
+  [[nodiscard]] auto sort_distribution_into(
+    ITape<T>& in,
+    ITape<T>& out,
+    T lo = std::numeric_limits<T>::min(),
+    T hi = std::numeric_limits<T>::max(),
+    bool progress = false,
+    TapeStats* scratch = nullptr
+  ) -> result_type<void> {
+    auto const max_elems_in_ram = in.config().template ram_limit_elems<typename ITape<T>::value_type>();
+    auto const size = in.size();
+    if(size == 0)
+      return {};
+    if(hi < lo)
+      return std::unexpected(std::format("invalid key range [{}, {}]", lo, hi));
+    auto const width = static_cast<std::uint64_t>(static_cast<std::int64_t>(hi) - static_cast<std::int64_t>(lo)) + 1;
+
+    if(progress)
+      common::println("\nDistributing tape...");
+    auto* const budget = &in.config().budget();
+    auto sink = WriteBehindBuffer<T>(out, max_elems_in_ram / 8, budget);
+    auto source = detail::CheckedTapeSource<T> { .tape = in, .lo = lo, .hi = hi, .size = size, .progress = progress, .error = {} };
+    auto res = detail::distribute<T>(source, size, detail::KeySpan { .base = 0, .width = width }, lo, sink, max_elems_in_ram, scratch, in.config().scratch(), budget);
+    if(auto const flushed = sink.finish(); res and not flushed)
+      res = std::unexpected(flushed.error());
+    if(source.error)
+      return std::unexpected(*source.error);
+    if(res and source.consumed != size)
+      return std::unexpected(std::format("read {} of {} elements from the input tape", source.consumed, size));
+    if(progress)
+      common::println();
+    return res;
+  }
+
+  /**
+   * Sorts the input tape with a distribution over splitters taken from a sample.
+   *
+   * Bucketing by the high bits only balances the buckets when the keys are spread
+   * evenly over their range. Here a uniform sample of the tape is taken first, in
+   * a quarter of the RAM limit, and its quantiles become the bucket boundaries, so
+   * the buckets come out of about the same size even on skewed keys. Sampling costs
+   * one extra read pass and a rewind of the input tape, which runs while the
+   * splitters are picked.
+   *
+   * \param in The input tape.
+   * \param out The output tape.
+   * \param progress If true, the function prints progress information.
+   * \param scratch If not null, receives the operations performed on bucket runs.
+   * \returns An empty result if the function was successful, otherwise
+   * an std::unexpected with an error message.
+   */
+  template <std::integral T>
+  requires (sizeof(T) <= sizeof(std::uint32_t))
+  [[nodiscard]] auto sort_sampled_distribution_into(
+    ITape<T>& in,
+    ITape<T>& out,
+    bool progress = false,
+    TapeStats* scratch = nullptr
+  ) -> result_type<void> {
+    auto const max_elems_in_ram = in.config().template ram_limit_elems<typename ITape<T>::value_type>();
+    auto const size = in.size();
+    if(size == 0)
+      return {};
+    auto constexpr lo = std::numeric_limits<T>::min();
+    auto constexpr hi = std::numeric_limits<T>::max();
+
+    if(progress)
+      common::println("\nSampling tape...");
+    auto sample = reservoir_sample(in, std::max<std::size_t>(1, max_elems_in_ram / 4));
+    if(not sample)
+      return std::unexpected(sample.error());
+    auto rewound = in.rewind_async();
+    auto const splitters = quantile_splitters(std::span(*sample), detail::distribution_buckets(max_elems_in_ram));
+    sample = budget_vector<T>();
+    rewound.get();
+
+    if(progress)
+      common::println("\nDistributing tape...");
+    auto* const budget = &in.config().budget();
+    auto sink = WriteBehindBuffer<T>(out, max_elems_in_ram / 8, budget);
+    auto source = detail::CheckedTapeSource<T> { .tape = in, .lo = lo, .hi = hi, .size = size, .progress = progress, .error = {} };
+    auto res = detail::distribute_by_splitters<T>(source, size, std::span<T const>(splitters), lo, hi, sink, max_elems_in_ram, scratch, in.config().scratch(), budget);
+    if(auto const flushed = sink.finish(); res and not flushed)
+      res = std::unexpected(flushed.error());
+    if(source.error)
+      return std::unexpected(*source.error);
+    if(res and source.consumed != size)
+      return std::unexpected(std::format("read {} of {} elements from the input tape", source.consumed, size));
+    if(progress)
+      common::println();
+    return res;
+  }
+} // namespace yuliy_test_task::algorithm
+
+#if defined UNIT_TESTS
+#include <gtest/gtest.h>
+
+TEST(Sort, distribution_with_and_without_key_range)
+{
+  using namespace yuliy_test_task;
+  auto const config = *Config::from_pwd();
+  for(auto const& [lo, hi] : { std::pair { 1, 1000 }, std::pair { std::numeric_limits<int32_t>::min(), std::numeric_limits<int32_t>::max() }, std::pair { 0, -1 } }) {
+    auto const path = std::filesystem::temp_directory_path() / std::format("yuliy_test_task_{}.tape", common::random_string(16));
+    {
+      auto const in = *BinaryTape<int32_t>::create(common::canonicalize("../tests/test_input2.tape"), config);
+      auto const out = *BinaryTape<int32_t>::create(path, config);
+      // an empty range stands for the sampled splitters
+      if(lo <= hi)
+        ASSERT_TRUE(algorithm::sort_distribution_into(*in, *out, lo, hi));
+      else
+        ASSERT_TRUE(algorithm::sort_sampled_distribution_into(*in, *out));
+    }
+    auto const out = *BinaryTape<int32_t>::create(path, config);
+    auto const ref = *BinaryTape<int32_t>::create(common::canonicalize("../tests/test_output2.tape"), config);
+    ASSERT_EQ(out->size(), ref->size());
+    for(std::size_t i = 0; i < ref->size(); ++i)
+      ASSERT_EQ(out->read_and_shift(), ref->read_and_shift());
+    std::filesystem::remove(path);
+  }
+}
+#endif
@@ -0,0 +1,358 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <cstddef>
+#include <expected>
+#include <filesystem>
+#include <format>
+#include <future>
+#include <limits>
+#include <numeric>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+#include <impl/io.hh>
+
+namespace yuliy_test_task::generate
+{
+  template <typename T>
+  using result_type = std::expected<T, std::string>;
+
+  /**
+   * The distributions of values a generated tape can have.
+   */
+  enum class Distribution
+  {
+    Uniform,       ///< uniform over the whole range of int32_t
+    SmallDomain,   ///< uniform over 1..domain, like `generate.py`
+    Zipf,          ///< 1..domain, value k with weight 1/k^skew
+    Sorted,        ///< ascending, spread over the whole range
+    Reverse,       ///< descending
+    NearlySorted,  ///< ascending, every value at most `displacement - 1` places from its sorted place
+    AllEqual,      ///< one value repeated
+    OrganPipe      ///< ascending to the middle, then descending
+  };
+
+  inline constexpr auto distributions = std::array {
+    Distribution::Uniform, Distribution::SmallDomain, Distribution::Zipf, Distribution::Sorted,
+    Distribution::Reverse, Distribution::NearlySorted, Distribution::AllEqual, Distribution::OrganPipe
+  };
+
+  [[nodiscard]] constexpr auto to_string(Distribution distribution) noexcept -> std::string_view {
+    switch(distribution) {
+      case Distribution::SmallDomain: return "small_domain";
+      case Distribution::Zipf: return "zipf";
+      case Distribution::Sorted: return "sorted";
+      case Distribution::Reverse: return "reverse";
+      case Distribution::NearlySorted: return "nearly_sorted";
+      case Distribution::AllEqual: return "all_equal";
+      case Distribution::OrganPipe: return "organ_pipe";
+      case Distribution::Uniform: break;
+    }
+    return "uniform";
+  }
+
+  /**
+   * Finds a distribution by its name.
+   *
+   * @param name The name, as returned by `to_string`.
+   *
+   * @return The distribution, or std::nullopt if there is none with the name.
+   */
+  [[nodiscard]] constexpr auto parse_distribution(std::string_view name) noexcept -> std::optional<Distribution> {
+    for(auto const distribution : distributions)
+      if(to_string(distribution) == name)
+        return distribution;
+    return std::nullopt;
+  }
+
+  /**
+   * What to generate.
+   */
+  struct Options
+  {
+    Distribution distribution = Distribution::Uniform;
+    std::size_t count = 0;
+    std::uint64_t seed = 0;
+    std::size_t domain = 1000;       ///< number of distinct values of `SmallDomain` and `Zipf`
+    double skew = 1.0;               ///< exponent of `Zipf`
+    std::size_t displacement = 100;  ///< bound of `NearlySorted`
+    std::size_t threads = 0;         ///< 0 for one per hardware thread
+  };
+
+  /**
+   * Computes the values of a tape.
+   *
+   * Every value depends only on the options and on its index: random values come
+   * from a counter-based splitmix64 stream, so any part of the tape can be
+   * computed on its own and a tape is the same for every number of threads.
+   */
+  class Generator
+  {
+    public:
+      explicit Generator(Options options)
+        : options_(options) {
+        this->options_.domain = std::clamp<std::size_t>(this->options_.domain, 1, std::numeric_limits<std::int32_t>::max());
+        this->options_.displacement = std::max<std::size_t>(1, this->options_.displacement);
+        if(this->options_.distribution == Distribution::Zipf)
+          this->build_zipf_table();
+      }
+
+      /**
+       * Computes consecutive values of the tape.
+       *
+       * @param first The index of the first value.
+       * @param values The buffer to fill, with the values from `first` on.
+       */
+      auto fill(std::size_t first, std::span<std::int32_t> values) const -> void {
+        auto const count = this->options_.count;
+        switch(this->options_.distribution) {
+          case Distribution::Uniform:
+            for(std::size_t i = 0; i < values.size(); ++i)
+              values[i] = static_cast<std::int32_t>(static_cast<std::uint32_t>(this->random(first + i)));
+            break;
+          case Distribution::SmallDomain:
+            for(std::size_t i = 0; i < values.size(); ++i)
+              values[i] = static_cast<std::int32_t>(1 + bounded(this->random(first + i), this->options_.domain));
+            break;
+          case Distribution::Zipf:
+            for(std::size_t i = 0; i < values.size(); ++i) {
+              // the high bits pick a column of the alias table, the low bits flip its coin
+              auto const r = this->random(first + i);
+              auto const column = bounded(r, this->zipf_alias_.size());
+              auto const coin = static_cast<double>(r & 0xFFFFFFFFu) * 0x1.0p-32;
+              values[i] = static_cast<std::int32_t>((coin < this->zipf_prob_[column] ? column : this->zipf_alias_[column]) + 1);
+            }
+            break;
+          case Distribution::Sorted:
+            for(std::size_t i = 0; i < values.size(); ++i)
+              values[i] = this->ascending(first + i, count);
+            break;
+          case Distribution::Reverse:
+            for(std::size_t i = 0; i < values.size(); ++i)
+              values[i] = this->ascending(count - 1 - (first + i), count);
+            break;
+          case Distribution::NearlySorted:
+            this->fill_nearly_sorted(first, values);
+            break;
+          case Distribution::AllEqual:
+            std::ranges::fill(values, static_cast<std::int32_t>(static_cast<std::uint32_t>(mix(this->options_.seed))));
+            break;
+          case Distribution::OrganPipe:
+            for(std::size_t i = 0; i < values.size(); ++i)
+              values[i] = this->ascending(std::min(first + i, count - 1 - (first + i)), (count + 1) / 2);
+            break;
+        }
+      }
+
+      [[nodiscard]] auto options() const noexcept -> Options const& { return this->options_; }
+
+    private:
+      [[nodiscard]] static constexpr auto mix(std::uint64_t x) noexcept -> std::uint64_t {
+        x += 0x9E3779B97F4A7C15u;
+        x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9u;
+        x = (x ^ (x >> 27)) * 0x94D049BB133111EBu;
+        return x ^ (x >> 31);
+      }
+
+      /**
+       * Maps a random number to 0..n-1 with the multiply-shift of its high bits.
+       */
+      [[nodiscard]] static constexpr auto bounded(std::uint64_t random, std::size_t n) noexcept -> std::uint64_t {
+        return ((random >> 32) * n) >> 32;
+      }
+
+      [[nodiscard]] auto random(std::size_t index, std::uint64_t stream = 0) const noexcept -> std::uint64_t {
+        return mix(this->options_.seed ^ mix(stream) ^ (index * 0xD1B54A32D192ED03u));
+      }
+
+      /**
+       * Builds the alias table of Vose's method for the Zipf weights, which
+       * samples a value with one random number instead of a search.
+       */
+      auto build_zipf_table() -> void {
+        auto const n = this->options_.domain;
+        auto scaled = std::vector<double>(n);
+        auto total = 0.0;
+        for(std::size_t k = 0; k < n; ++k)
+          total += scaled[k] = 1.0 / std::pow(static_cast<double>(k + 1), this->options_.skew);
+        for(auto& weight : scaled)
+          weight *= static_cast<double>(n) / total;
+        this->zipf_prob_.assign(n, 1.0);
+        this->zipf_alias_.resize(n);
+        std::iota(this->zipf_alias_.begin(), this->zipf_alias_.end(), 0);
+        auto small = std::vector<std::uint32_t>();
+        auto large = std::vector<std::uint32_t>();
+        for(std::size_t k = 0; k < n; ++k)
+          (scaled[k] < 1.0 ? small : large).push_back(static_cast<std::uint32_t>(k));
+        while(not small.empty() and not large.empty()) {
+          auto const less = small.back();
+          auto const more = large.back();
+          small.pop_back();
+          this->zipf_prob_[less] = scaled[less];
+          this->zipf_alias_[less] = more;
+          scaled[more] -= 1.0 - scaled[less];
+          if(scaled[more] < 1.0) {
+            large.pop_back();
+            small.push_back(more);
+          }
+        }
+      }
+
+      /**
+       * Returns the value at an index of an ascending sequence of `n` values
+       * spread evenly over the range of int32_t.
+       */
+      [[nodiscard]] static auto ascending(std::size_t index, std::size_t n) noexcept -> std::int32_t {
+        auto const step = 0x1.0p32 / static_cast<double>(std::max<std::size_t>(1, n));
+        auto const offset = std::min(std::floor(static_cast<double>(index) * step), 0x1.0p32 - 1);
+        return static_cast<std::int32_t>(static_cast<std::int64_t>(offset) + std::numeric_limits<std::int32_t>::min());
+      }
+
+      /**
+       * Shuffles the sorted sequence within consecutive windows of `displacement`
+       * values. Windows are shuffled whole, so a window that straddles the range
+       * is shuffled the same way from either side.
+       */
+      auto fill_nearly_sorted(std::size_t first, std::span<std::int32_t> values) const -> void {
+        auto const count = this->options_.count;
+        auto const window = this->options_.displacement;
+        auto order = std::vector<std::size_t>(window);
+        for(auto begin = first / window * window; begin < first + values.size(); begin += window) {
+          auto const size = std::min(window, count - begin);
+          std::iota(order.begin(), order.begin() + static_cast<std::ptrdiff_t>(size), begin);
+          // Fisher-Yates with our own stream, std::shuffle differs between standard libraries
+          for(auto i = size; i > 1; --i)
+            std::swap(order[i - 1], order[bounded(this->random(begin + i, 1), i)]);
+          for(auto i = std::max(begin, first); i < std::min(begin + size, first + values.size()); ++i)
+            values[i - first] = ascending(order[i - begin], count);
+        }
+      }
+
+      Options options_;
+      std::vector<double> zipf_prob_;
+      std::vector<std::uint32_t> zipf_alias_;
+  };
+
+  /**
+   * Writes a generated tape.
+   *
+   * The tape is computed in blocks, a batch of blocks at a time on all threads,
+   * while the previous batch is written with the bulk `write_n` of the tape
+   * backend.
+   *
+   * @param path The tape file, replaced if it exists.
+   * @param options What to generate.
+   *
+   * @return An empty result if the tape was written, otherwise an std::unexpected with an error message.
+   */
+  [[nodiscard]] inline auto write_tape(std::filesystem::path const& path, Options const& options) -> result_type<void> {
+    constexpr auto block_elems = std::size_t(256 * 1024);
+    auto const generator = Generator(options);
+    auto const threads = options.threads != 0 ? options.threads : std::max(1u, std::thread::hardware_concurrency());
+    auto error = std::error_code();
+    std::filesystem::remove(path, error);
+    try {
+      auto io = BinaryFileIO<std::int32_t>(path);
+      auto batches = std::array { std::vector<std::int32_t>(threads * block_elems), std::vector<std::int32_t>(threads * block_elems) };
+      auto writing = std::future<void>();
+      for(auto [first, batch] = std::pair(std::size_t(0), std::size_t(0)); first < options.count; first += threads * block_elems, batch ^= 1) {
+        auto const span = std::span(batches[batch]).first(std::min(batches[batch].size(), options.count - first));
+        {
+          auto workers = std::vector<std::jthread>();
+          for(auto begin = std::size_t(0); begin < span.size(); begin += block_elems)
+            workers.emplace_back([&generator, first, begin, block = span.subspan(begin, std::min(block_elems, span.size() - begin))] {
+              generator.fill(first + begin, block);
+            });
+        }
+        if(writing.valid())
+          writing.get();
+        writing = std::async(std::launch::async, [&io, span] {
+          if(not io.write_n(span))
+            throw std::runtime_error(std::format("{} values were not written", span.size()));
+        });
+      }
+      if(writing.valid())
+        writing.get();
+    } catch(std::exception const& e) {
+      return std::unexpected(std::format("failed to write tape {}: {}", path.generic_string(), e.what()));
+    }
+    if(std::filesystem::file_size(path, error) != options.count * sizeof(std::int32_t) or error)
+      return std::unexpected(std::format("failed to write tape {}", path.generic_string()));
+    return {};
+  }
+} // namespace yuliy_test_task::generate
+
+#if defined UNIT_TESTS
+#include <gtest/gtest.h>
+#include <fstream>
+#include <map>
+#include <impl/common.hh>
+
+TEST(Generate, tapes_do_not_depend_on_the_number_of_threads)
+{
+  using namespace yuliy_test_task;
+  auto const read = [](std::filesystem::path const& path) {
+    auto values = std::vector<std::int32_t>(std::filesystem::file_size(path) / sizeof(std::int32_t));
+    std::ifstream(path, std::ios::binary).read(reinterpret_cast<char*>(values.data()), static_cast<std::streamsize>(values.size() * sizeof(std::int32_t)));
+    return values;
+  };
+  auto const path = std::filesystem::temp_directory_path() / std::format("yuliy_test_task_{}.tape", common::random_string(16));
+  for(auto const distribution : generate::distributions) {
+    auto options = generate::Options { .distribution = distribution, .count = 600001, .seed = 7, .displacement = 1000, .threads = 1 };
+    ASSERT_TRUE(generate::write_tape(path, options));
+    auto const single = read(path);
+    ASSERT_EQ(single.size(), options.count);
+    options.threads = 5;
+    ASSERT_TRUE(generate::write_tape(path, options));
+    ASSERT_EQ(read(path), single) << to_string(distribution);
+  }
+  std::filesystem::remove(path);
+}
+
+TEST(Generate, distributions_have_their_shape)
+{
+  using namespace yuliy_test_task;
+  auto const values = [](generate::Options options) {
+    auto result = std::vector<std::int32_t>(options.count);
+    generate::Generator(options).fill(0, result);
+    return result;
+  };
+  auto const count = std::size_t(10000);
+  auto const sorted = values({ .distribution = generate::Distribution::Sorted, .count = count });
+  ASSERT_TRUE(std::ranges::is_sorted(sorted));
+  ASSERT_EQ(std::ranges::adjacent_find(sorted), sorted.end());
+  ASSERT_TRUE(std::ranges::is_sorted(values({ .distribution = generate::Distribution::Reverse, .count = count }), std::greater()));
+  auto const equal = values({ .distribution = generate::Distribution::AllEqual, .count = count, .seed = 3 });
+  ASSERT_EQ(std::ranges::count(equal, equal.front()), count);
+  auto const pipe = values({ .distribution = generate::Distribution::OrganPipe, .count = count });
+  ASSERT_TRUE(std::is_sorted(pipe.begin(), pipe.begin() + count / 2));
+  ASSERT_TRUE(std::is_sorted(pipe.begin() + count / 2, pipe.end(), std::greater()));
+  auto const small = values({ .distribution = generate::Distribution::SmallDomain, .count = count, .domain = 10 });
+  ASSERT_EQ(*std::ranges::min_element(small), 1);
+  ASSERT_EQ(*std::ranges::max_element(small), 10);
+  // a permutation of the sorted values with every value close to its place
+  auto nearly = values({ .distribution = generate::Distribution::NearlySorted, .count = count, .displacement = 16 });
+  ASSERT_FALSE(std::ranges::is_sorted(nearly));
+  for(std::size_t i = 0; i < count; ++i) {
+    auto const place = static_cast<std::size_t>(std::ranges::lower_bound(sorted, nearly[i]) - sorted.begin());
+    ASSERT_LT(std::max(i, place) - std::min(i, place), 16);
+  }
+  std::ranges::sort(nearly);
+  ASSERT_EQ(nearly, sorted);
+  auto frequency = std::map<std::int32_t, std::size_t>();
+  for(auto const value : values({ .distribution = generate::Distribution::Zipf, .count = count, .domain = 100 }))
+    ++frequency[value];
+  ASSERT_EQ(frequency.begin()->first, 1);
+  ASSERT_GT(frequency[1], frequency[2]);
+  ASSERT_GT(frequency[2], frequency[10]);
+  ASSERT_LE(frequency.rbegin()->first, 100);
+}
+#endif
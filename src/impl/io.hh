@@ -3,6 +3,8 @@
 #include <fstream>
 #include <sstream>
 #include <filesystem>
+#include <span>
+#include <vector>
 #include <impl/itape.hh>
 
 namespace yuliy_test_task
@@ -14,8 +16,10 @@ namespace yuliy_test_task
     virtual ~IO() = default;
 
     [[nodiscard]] virtual auto read() const -> T = 0;
+    [[nodiscard]] virtual auto read_n(std::span<T> values) -> std::size_t = 0;
     [[nodiscard]] virtual auto shift(ITape<T>::Direction direction) -> bool = 0;
     virtual auto write(T value) -> void = 0;
+    [[nodiscard]] virtual auto write_n(std::span<T const> values) -> bool = 0;
     virtual auto rewind() -> void = 0;
 
     [[nodiscard]] virtual auto end() const -> bool = 0;
@@ -33,7 +37,9 @@ namespace yuliy_test_task
   template <typename T, typename U>
   concept TapeIO = requires(T t, U value) {
     { t.read() } -> std::convertible_to<U>;
+    { t.read_n(std::span<U>()) } -> std::same_as<std::size_t>;
     { t.write(value) } -> std::same_as<void>;
+    { t.write_n(std::span<U const>()) } -> std::same_as<bool>;
     { t.rewind() } -> std::same_as<void>;
     { t.end() } -> std::same_as<bool>;
     { t.size() } -> std::same_as<std::size_t>;
@@ -71,12 +77,21 @@ namespace yuliy_test_task
       std::streampos position_;
   };
 
+  /**
+   * A tape backend that stores the values in a binary file.
+   *
+   * Given a block size, single values are read through a buffer of one block,
+   * like the buffer of a drive, so walking the tape value by value reads every
+   * block from the file once. The buffer belongs to the device and is not charged
+   * to the memory budget of a sort. Writes drop it.
+   */
   template <TapeElement T>
-  class BinaryFileIO : public AbstractFileIO<T>
+  class BinaryFileIO final : public AbstractFileIO<T>
   {
     public:
-      explicit BinaryFileIO(std::filesystem::path filename)
-        : AbstractFileIO<T>(std::move(filename)) {
+      explicit BinaryFileIO(std::filesystem::path filename, std::size_t block_elems = 1)
+        : AbstractFileIO<T>(std::move(filename))
+        , block_(block_elems > 1 ? block_elems : 0) {
         if(not exists(this->filename_)) {
           this->handle_.open(this->filename_, std::ios::out | std::ios::binary);
           if(not this->handle_)
@@ -89,12 +104,28 @@ namespace yuliy_test_task
       }
 
       [[nodiscard]] auto read() const -> T override {
+        if(not this->block_.empty()) {
+          auto const index = static_cast<std::size_t>(static_cast<std::streamoff>(this->position_)) / sizeof(T);
+          if(index < this->block_first_ or index >= this->block_first_ + this->block_count_)
+            this->load_block(index);
+          if(index < this->block_first_ + this->block_count_)
+            return this->block_[index - this->block_first_];
+          // past the end of the file, read it directly to set its state
+        }
         auto value = T();
         this->handle_.read(reinterpret_cast<char*>(&value), sizeof(T));
         this->handle_.seekp(this->position_, std::ios_base::beg);
         return static_cast<int>(value);
       }
 
+      [[nodiscard]] auto read_n(std::span<T> values) -> std::size_t override {
+        this->handle_.read(reinterpret_cast<char*>(values.data()), static_cast<std::streamsize>(values.size_bytes()));
+        auto const n = static_cast<std::size_t>(this->handle_.gcount()) / sizeof(T);
+        this->position_ += static_cast<std::streamoff>(n * sizeof(T));
+        this->handle_.seekp(this->position_, std::ios_base::beg);
+        return n;
+      }
+
       [[nodiscard]] auto shift(ITape<T>::Direction direction) -> bool override {
         if(not this->handle_)
           return false;
@@ -107,16 +138,41 @@ namespace yuliy_test_task
       }
 
       auto write(T value) -> void override {
+        this->block_count_ = 0;
         auto const value_ = static_cast<T>(value);
         this->handle_.write(reinterpret_cast<char const*>(&value_), sizeof(T));
         this->handle_.seekp(this->position_, std::ios_base::beg);
       }
 
+      [[nodiscard]] auto write_n(std::span<T const> values) -> bool override {
+        this->block_count_ = 0;
+        this->handle_.write(reinterpret_cast<char const*>(values.data()), static_cast<std::streamsize>(values.size_bytes()));
+        if(this->handle_.fail())
+          return false;
+        this->position_ += static_cast<std::streamoff>(values.size_bytes());
+        this->handle_.seekp(this->position_, std::ios_base::beg);
+        return true;
+      }
+
       [[nodiscard]] auto size() const -> std::size_t override {
         this->handle_.seekp(0, std::ios_base::end);
         auto const size = static_cast<std::size_t>(this->handle_.tellp()) / sizeof(T);
         this->handle_.seekp(this->position_, std::ios_base::beg);
         return size;
       }
+
+    private:
+      auto load_block(std::size_t index) const -> void {
+        this->block_first_ = index / this->block_.size() * this->block_.size();
+        this->handle_.seekg(static_cast<std::streamoff>(this->block_first_ * sizeof(T)), std::ios_base::beg);
+        this->handle_.read(reinterpret_cast<char*>(this->block_.data()), static_cast<std::streamsize>(this->block_.size() * sizeof(T)));
+        this->block_count_ = static_cast<std::size_t>(this->handle_.gcount()) / sizeof(T);
+        this->handle_.clear();
+        this->handle_.seekp(this->position_, std::ios_base::beg);
+      }
+
+      mutable std::vector<T> block_;
+      mutable std::size_t block_first_ = 0;
+      mutable std::size_t block_count_ = 0;
   };
 } // namespace yuliy_test_task
\ No newline at end of file
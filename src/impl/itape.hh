@@ -4,7 +4,10 @@
 #include <concepts>
 #include <expected>
 #include <vector>
+#include <span>
+#include <future>
 #include <impl/config.hh>
+#include <impl/memory.hh>
 
 namespace yuliy_test_task
 {
@@ -13,6 +16,54 @@ namespace yuliy_test_task
     and std::is_standard_layout_v<T>
     and std::is_trivial_v<T>;
 
+  /**
+   * Counters of the elementary operations performed on a tape.
+   */
+  struct TapeStats
+  {
+    std::size_t reads = 0;
+    std::size_t writes = 0;
+    std::size_t shifts = 0;
+    std::size_t rewinds = 0;
+    std::size_t bytes = 0;     ///< bytes the head passed over
+    std::size_t stalls = 0;    ///< times the drive had to start streaming again
+    std::size_t reversals = 0; ///< times the tape changed direction
+
+    auto operator+=(TapeStats const& other) -> TapeStats& {
+      this->reads += other.reads;
+      this->writes += other.writes;
+      this->shifts += other.shifts;
+      this->rewinds += other.rewinds;
+      this->bytes += other.bytes;
+      this->stalls += other.stalls;
+      this->reversals += other.reversals;
+      return *this;
+    }
+
+    /**
+     * Calculates the time these operations cost under the delays of a configuration.
+     *
+     * Under the streaming model of the configuration, the bytes are charged at the
+     * streaming rate and every stall and reversal its penalty instead of the flat
+     * per-operation delays.
+     *
+     * @param config The configuration to take the delays from.
+     *
+     * @return The modeled time in microseconds.
+     */
+    [[nodiscard]] auto modeled_time(Config const& config) const -> std::chrono::microseconds {
+      if(auto const& model = config.streaming())
+        return std::chrono::microseconds(static_cast<std::int64_t>(this->bytes / model->bytes_per_us))
+          + model->start_stop_penalty * static_cast<std::int64_t>(this->stalls)
+          + model->locate_delay * static_cast<std::int64_t>(this->reversals)
+          + config.tape_rewind_delay() * static_cast<std::int64_t>(this->rewinds);
+      return config.read_delay() * static_cast<std::int64_t>(this->reads)
+        + config.write_delay() * static_cast<std::int64_t>(this->writes)
+        + config.tape_shift_delay() * static_cast<std::int64_t>(this->shifts)
+        + config.tape_rewind_delay() * static_cast<std::int64_t>(this->rewinds);
+    }
+  };
+
   template <TapeElement T>
   class ITape
   {
@@ -46,10 +97,20 @@ namespace yuliy_test_task
     /**
     * Reads and shifts n values from the tape.
     *
+    * The values are stored in a vector charged to the memory budget of the tape's configuration.
+    *
     * @param n The number of values to read and shift.
     * @return The read values.
     */
-    [[nodiscard]] virtual auto read_and_shift_n(std::size_t n) -> result_type<std::vector<value_type>> = 0;
+    [[nodiscard]] virtual auto read_and_shift_n(std::size_t n) -> result_type<budget_vector<value_type>> = 0;
+
+    /**
+    * Reads and shifts values from the tape into a buffer owned by the caller.
+    *
+    * @param values The buffer to fill.
+    * @return The number of values read, fewer than the size of the buffer at the end of the tape.
+    */
+    [[nodiscard]] virtual auto read_and_shift_n(std::span<value_type> values) -> result_type<std::size_t> = 0;
 
     /**
     * Shifts the tape in the specified direction.
@@ -78,13 +139,29 @@ namespace yuliy_test_task
     *
     * @param values The values to write and shift.
     */
-    [[nodiscard]] virtual auto write_and_shift_n(std::vector<value_type> const& values) -> result_type<void> = 0;
+    [[nodiscard]] virtual auto write_and_shift_n(std::span<value_type const> values) -> result_type<void> = 0;
 
     /**
     * Rewinds the tape to the beginning.
     */
     virtual auto rewind() -> void = 0;
 
+    /**
+    * Starts rewinding the tape to the beginning.
+    *
+    * Every tape has a drive of its own, so rewinds of different tapes overlap with
+    * each other and with work on other tapes. The tape must not be used until the
+    * returned future is ready. By default the rewind is done before returning.
+    *
+    * @return A future that becomes ready when the tape is at its beginning.
+    */
+    [[nodiscard]] virtual auto rewind_async() -> std::future<void> {
+      this->rewind();
+      auto done = std::promise<void>();
+      done.set_value();
+      return done.get_future();
+    }
+
     /**
     * Checks if the tape is at the end of the file.
     *
@@ -120,5 +197,22 @@ namespace yuliy_test_task
     * @return The configuration of the tape.
     */
     [[nodiscard]] virtual auto config() const -> Config const& = 0;
+
+    /**
+    * Returns the operations performed on the tape so far.
+    *
+    * @return The operation counters of the tape.
+    */
+    [[nodiscard]] virtual auto stats() const -> TapeStats const& = 0;
   };
+
+  /**
+   * A tape whose concrete type is known at compile time.
+   *
+   * Its class is final, so calls made through it are resolved statically and can
+   * be inlined, while calls made through `ITape` stay virtual.
+   */
+  template <typename Tp>
+  concept FinalTape = std::is_final_v<Tp>
+    and std::derived_from<Tp, ITape<typename Tp::value_type>>;
 } // namespace yuliy_test_task
@@ -0,0 +1,373 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <format>
+#include <type_traits>
+#if defined __linux__
+#include <sys/mman.h>
+#endif
+
+namespace yuliy_test_task
+{
+  /**
+   * A single region of memory, allocated once, that hands out aligned blocks.
+   *
+   * Blocks are carved first-fit from an address-ordered free list that lives in
+   * the free memory itself, and freed blocks are coalesced with their neighbours,
+   * so handing out and taking back blocks never calls the system allocator.
+   */
+  class Arena
+  {
+    public:
+      /**
+       * The alignment of every block, a cache line.
+       */
+      static constexpr std::size_t alignment = 64;
+
+      /**
+       * The size of a huge page, used to align the region when huge pages are requested.
+       */
+      static constexpr std::size_t huge_page_bytes = std::size_t(2) << 20;
+
+      /**
+       * Allocates the region.
+       *
+       * @param bytes The size of the region.
+       * @param huge_pages If true, the region is aligned and sized to huge pages and,
+       * on Linux, advised to be backed by them.
+       */
+      Arena(std::size_t bytes, bool huge_pages) {
+        auto const align = huge_pages ? huge_page_bytes : alignment;
+        this->size_ = std::max(alignment, (bytes + align - 1) / align * align);
+        this->align_ = align;
+        this->base_ = static_cast<std::byte*>(::operator new(this->size_, std::align_val_t(align)));
+#if defined __linux__ and defined MADV_HUGEPAGE
+        if(huge_pages)
+          ::madvise(this->base_, this->size_, MADV_HUGEPAGE);
+#endif
+        this->free_ = ::new(this->base_) FreeBlock { .size = this->size_, .next = nullptr };
+      }
+
+      ~Arena() noexcept {
+        ::operator delete(this->base_, this->size_, std::align_val_t(this->align_));
+      }
+
+      Arena(Arena const&) = delete;
+      Arena& operator=(Arena const&) = delete;
+
+      /**
+       * Hands out a block.
+       *
+       * @param bytes The size of the block.
+       * @return The block, or null if no free range is large enough.
+       */
+      [[nodiscard]] auto allocate(std::size_t bytes) noexcept -> void* {
+        bytes = round_up(bytes);
+        for(auto** link = &this->free_; *link; link = &(*link)->next) {
+          auto* const block = *link;
+          if(block->size < bytes)
+            continue;
+          if(block->size == bytes)
+            *link = block->next;
+          else
+            *link = ::new(reinterpret_cast<std::byte*>(block) + bytes) FreeBlock { .size = block->size - bytes, .next = block->next };
+          return block;
+        }
+        return nullptr;
+      }
+
+      /**
+       * Takes a block back.
+       *
+       * @param p The block, handed out by this arena.
+       * @param bytes The size the block was requested with.
+       */
+      auto deallocate(void* p, std::size_t bytes) noexcept -> void {
+        auto* const block = ::new(p) FreeBlock { .size = round_up(bytes), .next = nullptr };
+        auto* prev = static_cast<FreeBlock*>(nullptr);
+        auto* next = this->free_;
+        while(next and next < block) {
+          prev = next;
+          next = next->next;
+        }
+        block->next = next;
+        if(next and end_of(block) == reinterpret_cast<std::byte*>(next)) {
+          block->size += next->size;
+          block->next = next->next;
+        }
+        if(prev and end_of(prev) == reinterpret_cast<std::byte*>(block)) {
+          prev->size += block->size;
+          prev->next = block->next;
+        } else if(prev)
+          prev->next = block;
+        else
+          this->free_ = block;
+      }
+
+      /**
+       * Checks if a pointer was handed out by this arena.
+       *
+       * @param p The pointer to check.
+       * @return `true` if the pointer lies in the region, `false` otherwise.
+       */
+      [[nodiscard]] auto contains(void const* p) const noexcept -> bool {
+        auto const* const byte = static_cast<std::byte const*>(p);
+        return byte >= this->base_ and byte < this->base_ + this->size_;
+      }
+
+    private:
+      struct FreeBlock
+      {
+        std::size_t size;
+        FreeBlock* next;
+      };
+
+      [[nodiscard]] static constexpr auto round_up(std::size_t bytes) noexcept -> std::size_t {
+        return std::max<std::size_t>(1, (bytes + alignment - 1) / alignment) * alignment;
+      }
+
+      [[nodiscard]] static auto end_of(FreeBlock* block) noexcept -> std::byte* {
+        return reinterpret_cast<std::byte*>(block) + block->size;
+      }
+
+      std::byte* base_ = nullptr;
+      std::size_t size_ = 0;
+      std::size_t align_ = alignment;
+      FreeBlock* free_ = nullptr;
+  };
+
+  /**
+   * The RAM budget of a sort, shared by every buffer that holds keys.
+   *
+   * Buffers reserve their bytes before they allocate them and release them when
+   * they are freed, so the budget knows how much is in use at any moment and the
+   * most that was ever in use. A reservation that would exceed the limit fails.
+   *
+   * The storage itself comes from an arena of the size of the limit, allocated on
+   * first use and reused by every buffer afterwards. Only a request that does not
+   * fit in the arena, because its free space is fragmented, goes to the heap.
+   *
+   * Fixed bookkeeping that does not grow with the RAM limit, such as file handles
+   * or the cursor and heap structures of a merge, is not charged.
+   */
+  class MemoryBudget
+  {
+    public:
+      /**
+       * Creates a budget.
+       *
+       * @param limit_bytes The number of bytes that may be in use at once.
+       * @param huge_pages If true, the arena is backed by huge pages where possible.
+       */
+      explicit MemoryBudget(std::size_t limit_bytes, bool huge_pages = false) noexcept
+        : limit_(limit_bytes)
+        , huge_pages_(huge_pages)
+      {}
+
+      MemoryBudget(MemoryBudget const&) = delete;
+      MemoryBudget& operator=(MemoryBudget const&) = delete;
+
+      /**
+       * Reserves bytes if they fit in the budget.
+       *
+       * @param bytes The number of bytes to reserve.
+       * @return `true` if the bytes were reserved, `false` if they would exceed the limit.
+       */
+      [[nodiscard]] auto try_reserve(std::size_t bytes) noexcept -> bool {
+        auto used = this->used_.load(std::memory_order_relaxed);
+        do {
+          if(bytes > this->limit_ - used)
+            return false;
+        } while(not this->used_.compare_exchange_weak(used, used + bytes, std::memory_order_relaxed));
+        auto peak = this->peak_.load(std::memory_order_relaxed);
+        while(peak < used + bytes and not this->peak_.compare_exchange_weak(peak, used + bytes, std::memory_order_relaxed))
+          ;
+        return true;
+      }
+
+      /**
+       * Returns previously reserved bytes to the budget.
+       *
+       * @param bytes The number of bytes to release.
+       */
+      auto release(std::size_t bytes) noexcept -> void {
+        this->used_.fetch_sub(bytes, std::memory_order_relaxed);
+      }
+
+      /**
+       * Reserves bytes and allocates storage for them.
+       *
+       * @param bytes The number of bytes.
+       * @return The storage, aligned to `Arena::alignment`.
+       *
+       * @throws BudgetExceeded if the bytes do not fit in the budget.
+       */
+      [[nodiscard]] auto allocate(std::size_t bytes) -> void*;
+
+      /**
+       * Frees storage returned by `allocate` and releases its bytes.
+       *
+       * @param p The storage.
+       * @param bytes The number of bytes it was allocated with.
+       */
+      auto deallocate(void* p, std::size_t bytes) noexcept -> void {
+        {
+          auto lock = std::lock_guard(this->arena_mutex_);
+          if(this->arena_ and this->arena_->contains(p))
+            this->arena_->deallocate(p, bytes);
+          else
+            ::operator delete(p, bytes, std::align_val_t(Arena::alignment));
+        }
+        this->release(bytes);
+      }
+
+      /**
+       * Returns the limit of the budget.
+       *
+       * @return The number of bytes that may be in use at once.
+       */
+      [[nodiscard]] auto limit() const noexcept -> std::size_t { return this->limit_; }
+
+      /**
+       * Returns the number of bytes in use.
+       *
+       * @return The number of reserved bytes.
+       */
+      [[nodiscard]] auto used() const noexcept -> std::size_t { return this->used_.load(std::memory_order_relaxed); }
+
+      /**
+       * Returns the high-water mark of the budget.
+       *
+       * @return The largest number of bytes that were in use at once.
+       */
+      [[nodiscard]] auto peak() const noexcept -> std::size_t { return this->peak_.load(std::memory_order_relaxed); }
+
+      /**
+       * Returns the number of allocations the arena could not serve.
+       *
+       * @return The number of allocations that went to the heap.
+       */
+      [[nodiscard]] auto heap_fallbacks() const noexcept -> std::size_t { return this->heap_fallbacks_.load(std::memory_order_relaxed); }
+
+    private:
+      std::size_t limit_;
+      bool huge_pages_;
+      std::atomic<std::size_t> used_ = 0;
+      std::atomic<std::size_t> peak_ = 0;
+      std::atomic<std::size_t> heap_fallbacks_ = 0;
+      std::mutex arena_mutex_;
+      std::unique_ptr<Arena> arena_;
+  };
+
+  /**
+   * Thrown by `BudgetAllocator` when an allocation does not fit in its budget.
+   */
+  class BudgetExceeded : public std::bad_alloc
+  {
+    public:
+      BudgetExceeded(std::size_t requested, MemoryBudget const& budget)
+        : message_(std::format("memory budget exceeded: requested {} bytes with {} of {} bytes in use",
+            requested, budget.used(), budget.limit()))
+      {}
+
+      [[nodiscard]] auto what() const noexcept -> char const* override { return this->message_.c_str(); }
+
+    private:
+      std::string message_;
+  };
+
+  inline auto MemoryBudget::allocate(std::size_t bytes) -> void* {
+    if(not this->try_reserve(bytes))
+      throw BudgetExceeded(bytes, *this);
+    try {
+      auto lock = std::lock_guard(this->arena_mutex_);
+      if(not this->arena_)
+        // with room for blocks rounded up to the alignment
+        this->arena_ = std::make_unique<Arena>(this->limit_ + this->limit_ / 8, this->huge_pages_);
+      if(auto* const p = this->arena_->allocate(bytes))
+        return p;
+      this->heap_fallbacks_.fetch_add(1, std::memory_order_relaxed);
+      return ::operator new(bytes, std::align_val_t(Arena::alignment));
+    } catch(...) {
+      this->release(bytes);
+      throw;
+    }
+  }
+
+  /**
+   * An allocator that charges every allocation to a memory budget.
+   *
+   * A default-constructed allocator is not bound to any budget and allocates
+   * freely, which keeps containers usable outside of a sort.
+   */
+  template <typename T>
+  class BudgetAllocator
+  {
+    public:
+      using value_type = T;
+      using propagate_on_container_copy_assignment = std::true_type;
+      using propagate_on_container_move_assignment = std::true_type;
+      using propagate_on_container_swap = std::true_type;
+
+      BudgetAllocator() noexcept = default;
+
+      /**
+       * Creates an allocator bound to a budget.
+       *
+       * @param budget The budget to charge, or null to allocate freely.
+       */
+      explicit BudgetAllocator(MemoryBudget* budget) noexcept
+        : budget_(budget)
+      {}
+
+      template <typename U>
+      BudgetAllocator(BudgetAllocator<U> const& other) noexcept
+        : budget_(other.budget())
+      {}
+
+      /**
+       * Allocates storage for n values after reserving it from the budget.
+       *
+       * @param n The number of values.
+       * @return The allocated storage.
+       *
+       * @throws BudgetExceeded if the storage does not fit in the budget.
+       */
+      [[nodiscard]] auto allocate(std::size_t n) -> T* {
+        static_assert(alignof(T) <= Arena::alignment);
+        if(this->budget_)
+          return static_cast<T*>(this->budget_->allocate(n * sizeof(T)));
+        return std::allocator<T>().allocate(n);
+      }
+
+      auto deallocate(T* p, std::size_t n) noexcept -> void {
+        if(this->budget_)
+          this->budget_->deallocate(p, n * sizeof(T));
+        else
+          std::allocator<T>().deallocate(p, n);
+      }
+
+      [[nodiscard]] auto budget() const noexcept -> MemoryBudget* { return this->budget_; }
+
+      template <typename U>
+      [[nodiscard]] auto operator==(BudgetAllocator<U> const& other) const noexcept -> bool {
+        return this->budget_ == other.budget();
+      }
+
+    private:
+      MemoryBudget* budget_ = nullptr;
+  };
+
+  /**
+   * A vector whose storage is charged to a memory budget.
+   */
+  template <typename T>
+  using budget_vector = std::vector<T, BudgetAllocator<T>>;
+} // namespace yuliy_test_task
+
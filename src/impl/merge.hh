@@ -0,0 +1,290 @@
+#pragma once
+
+#include <vector>
+#include <span>
+#include <array>
+#include <queue>
+#include <algorithm>
+#include <functional>
+#include <utility>
+#include <impl/itape.hh>
+#include <impl/memory.hh>
+#include <impl/simd.hh>
+
+namespace yuliy_test_task::algorithm::detail
+{
+  /**
+   * Buffered forward cursor over a sorted run.
+   *
+   * The run must provide `read_n(std::span<T>) -> std::size_t`, which fills the
+   * span from the current position and returns the number of values read.
+   */
+  template <typename T, typename Run>
+  class RunCursor
+  {
+    public:
+      /**
+       * Creates a cursor and fills its buffer from the run.
+       *
+       * @param run The run to read.
+       * @param block_elems The number of values the buffer holds.
+       * @param budget The memory budget the buffer is charged to, if any.
+       */
+      RunCursor(Run& run, std::size_t block_elems, MemoryBudget* budget = nullptr)
+        : run_(&run)
+        , buffer_(std::max<std::size_t>(1, block_elems), BudgetAllocator<T>(budget)) {
+        this->refill();
+      }
+
+      /**
+       * Checks if the run is exhausted.
+       *
+       * @return `true` if there are no more values in the run, `false` otherwise.
+       */
+      [[nodiscard]] auto empty() const -> bool { return this->pos_ == this->len_; }
+
+      /**
+       * Returns the current value of the run. The run must not be empty.
+       *
+       * @return The current value.
+       */
+      [[nodiscard]] auto head() const -> T { return this->buffer_[this->pos_]; }
+
+      /**
+       * Moves the cursor to the next value, refilling the buffer if needed.
+       */
+      auto advance() -> void {
+        if(++this->pos_ == this->len_)
+          this->refill();
+      }
+
+      /**
+       * Returns the values that are already buffered, starting at the current one.
+       *
+       * @return The buffered values, empty only if the run is exhausted.
+       */
+      [[nodiscard]] auto buffered() const -> std::span<T const> {
+        return std::span<T const>(this->buffer_).subspan(this->pos_, this->len_ - this->pos_);
+      }
+
+      /**
+       * Moves the cursor `n` values forward, refilling the buffer if needed.
+       *
+       * @param n The number of values to skip, at most `buffered().size()`.
+       */
+      auto skip(std::size_t n) -> void {
+        this->pos_ += n;
+        if(this->pos_ == this->len_)
+          this->refill();
+      }
+
+    private:
+      auto refill() -> void {
+        this->pos_ = 0;
+        this->len_ = this->run_->read_n(std::span<T>(this->buffer_));
+      }
+
+      Run* run_;
+      budget_vector<T> buffer_;
+      std::size_t pos_ = 0;
+      std::size_t len_ = 0;
+  };
+
+  /**
+   * Counts the leading values of a sorted range that are not greater than a bound.
+   *
+   * The boundary is bracketed by exponential search from the front and then
+   * located by binary search, so a short prefix costs O(log n) comparisons no
+   * matter how long the range is.
+   *
+   * \param values The values to search, sorted by `comp`.
+   * \param bound The inclusive upper bound.
+   * \param comp The ordering of the values.
+   * \returns The length of the prefix whose values are all `<= bound`.
+   */
+  template <typename T, typename Compare = std::less<>>
+  [[nodiscard]] auto gallop(std::span<T const> values, T const& bound, Compare comp = {}) -> std::size_t {
+    auto lo = std::size_t(0);
+    auto hi = std::size_t(1);
+    while(hi < values.size() and not comp(bound, values[hi])) {
+      lo = hi;
+      hi *= 2;
+    }
+    hi = std::min(hi, values.size());
+    if(values.empty() or comp(bound, values[lo]))
+      return 0;
+    return static_cast<std::size_t>(std::upper_bound(values.begin() + lo, values.begin() + hi, bound, comp) - values.begin());
+  }
+
+  /**
+   * Finds the index of the first head that is not ordered after any other one.
+   *
+   * The natural ascending order goes through the vectorized `simd::argmin`.
+   */
+  template <typename T, typename Compare>
+  [[nodiscard]] auto argmin(std::span<T const> values, Compare comp) -> std::size_t {
+    if constexpr(std::same_as<Compare, std::less<>>)
+      return simd::argmin(values);
+    else
+      return static_cast<std::size_t>(std::ranges::min_element(values, comp) - values.begin());
+  }
+
+  /**
+   * The largest fan-in for which `linear_merge` is used instead of `heap_merge`.
+   */
+  inline constexpr std::size_t linear_merge_max_fan_in = 16;
+
+  /**
+   * Splits a read budget between the cursors of a merge.
+   *
+   * A merge of more than `linear_merge_max_fan_in` runs first sets aside room
+   * for the entries of its heap, the rest is shared evenly by the cursors.
+   *
+   * \param cursor_budget The number of elements shared by the cursors and the heap.
+   * \param runs The number of runs to merge.
+   * \returns The number of elements in the buffer of every cursor, at least 1.
+   */
+  template <typename T>
+  [[nodiscard]] constexpr auto cursor_block_elems(std::size_t cursor_budget, std::size_t runs) -> std::size_t {
+    runs = std::max<std::size_t>(1, runs);
+    auto const entry_elems = (sizeof(std::pair<T, std::size_t>) + sizeof(T) - 1) / sizeof(T);
+    auto const heap = runs > linear_merge_max_fan_in ? runs * entry_elems : 0;
+    return std::max<std::size_t>(1, (cursor_budget - std::min(cursor_budget, heap)) / runs);
+  }
+
+  /**
+   * Merges sorted runs with a binary min-heap of run heads.
+   *
+   * When a run wins, every buffered value of that run that is not greater than
+   * the next-best head is located with `gallop` and emitted as one block, so a
+   * run that supplies a long stretch of the output costs one heap pop and push
+   * per block rather than per value.
+   *
+   * \param cursors The cursors over the runs to merge.
+   * \param sink The destination, must provide `push(std::span<T const>)`.
+   * \param on_emit Called with the number of values after every emitted block.
+   * \param comp The ordering of the runs and of the output.
+   * \param budget The memory budget the heap is charged to, if any.
+   */
+  template <typename T, typename Run, typename Sink, typename OnEmit, typename Compare = std::less<>>
+  auto heap_merge(
+    std::vector<RunCursor<T, Run>>& cursors,
+    Sink& sink,
+    OnEmit&& on_emit,
+    Compare comp = {},
+    MemoryBudget* budget = nullptr
+  ) -> void {
+    using value_index_type = std::pair<T, std::size_t>;
+    auto compare = [comp](
+      value_index_type const& lhs,
+      value_index_type const& rhs
+    ) -> bool { return comp(rhs.first, lhs.first); };
+    // the heap never holds more than one entry per run, so it is charged once
+    auto entries = budget_vector<value_index_type>(BudgetAllocator<value_index_type>(budget));
+    entries.reserve(cursors.size());
+    auto min_heap = std::priority_queue<
+      value_index_type,
+      budget_vector<value_index_type>,
+      decltype(compare)
+    >(compare, std::move(entries));
+    for(std::size_t i = 0; i < cursors.size(); ++i)
+      if(not cursors[i].empty())
+        min_heap.emplace(cursors[i].head(), i);
+    while(not min_heap.empty()) {
+      auto const idx = min_heap.top().second;
+      min_heap.pop();
+      auto& cursor = cursors[idx];
+      while(not cursor.empty()) {
+        auto const block = cursor.buffered();
+        auto const n = min_heap.empty() ? block.size() : gallop(block, min_heap.top().first, comp);
+        sink.push(block.first(n));
+        on_emit(n);
+        cursor.skip(n);
+        if(n < block.size())
+          break;
+      }
+      if(not cursor.empty())
+        min_heap.emplace(cursor.head(), idx);
+    }
+  }
+
+  /**
+   * Merges a small number of sorted runs by scanning all run heads.
+   *
+   * The heads are kept in a contiguous array and the smallest one is located
+   * with `simd::argmin`, which beats heap maintenance for a fan-in of up to
+   * `linear_merge_max_fan_in` runs. Exhausted runs are swap-removed so the
+   * scanned array only ever contains live heads.
+   *
+   * \param cursors The cursors over the runs to merge, at most `linear_merge_max_fan_in`.
+   * \param sink The destination, must provide `push(T)`.
+   * \param on_emit Called with the number of values after every emitted value.
+   * \param comp The ordering of the runs and of the output.
+   */
+  template <typename T, typename Run, typename Sink, typename OnEmit, typename Compare = std::less<>>
+  auto linear_merge(std::vector<RunCursor<T, Run>>& cursors, Sink& sink, OnEmit&& on_emit, Compare comp = {}) -> void {
+    auto heads = std::array<T, linear_merge_max_fan_in>();
+    auto owners = std::array<std::size_t, linear_merge_max_fan_in>();
+    auto live = std::size_t(0);
+    for(std::size_t i = 0; i < cursors.size(); ++i) {
+      if(cursors[i].empty())
+        continue;
+      heads[live] = cursors[i].head();
+      owners[live++] = i;
+    }
+    while(live > 0) {
+      auto const i = argmin(std::span<T const>(heads.data(), live), comp);
+      sink.push(heads[i]);
+      on_emit(1);
+      auto& cursor = cursors[owners[i]];
+      cursor.advance();
+      if(not cursor.empty()) {
+        heads[i] = cursor.head();
+        continue;
+      }
+      --live;
+      heads[i] = heads[live];
+      owners[i] = owners[live];
+    }
+  }
+
+  /**
+   * Merges sorted runs, picking the kernel that suits the fan-in.
+   *
+   * \param cursors The cursors over the runs to merge.
+   * \param sink The destination, must provide `push(T)` and `push(std::span<T const>)`.
+   * \param on_emit Called with the number of values after every emitted block.
+   * \param comp The ordering of the runs and of the output, ascending by default.
+   * \param budget The memory budget the heap is charged to, if any.
+   */
+  template <typename T, typename Run, typename Sink, typename OnEmit, typename Compare = std::less<>>
+  auto merge(
+    std::vector<RunCursor<T, Run>>& cursors,
+    Sink& sink,
+    OnEmit&& on_emit,
+    Compare comp = {},
+    MemoryBudget* budget = nullptr
+  ) -> void {
+    if(cursors.size() <= linear_merge_max_fan_in)
+      linear_merge(cursors, sink, on_emit, comp);
+    else
+      heap_merge(cursors, sink, on_emit, comp, budget);
+  }
+} // namespace yuliy_test_task::algorithm::detail
+
+#if defined UNIT_TESTS
+#include <gtest/gtest.h>
+
+TEST(Merge, gallop_counts_prefix_not_greater_than_bound)
+{
+  using yuliy_test_task::algorithm::detail::gallop;
+  auto const values = std::vector<int> { 1, 2, 2, 3, 5, 8, 13, 21, 34, 55 };
+  auto const span = std::span<int const>(values);
+  ASSERT_EQ(gallop(span, 0), 0);
+  ASSERT_EQ(gallop(span, 1), 1);
+  ASSERT_EQ(gallop(span, 2), 3);
+  ASSERT_EQ(gallop(span, 20), 7);
+  ASSERT_EQ(gallop(span, 55), 10);
+  ASSERT_EQ(gallop(std::span<int const>(), 55), 0);
+}
+#endif
@@ -0,0 +1,274 @@
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <functional>
+#include <filesystem>
+#include <stdexcept>
+#include <impl/itape.hh>
+#include <impl/tape.hh>
+#include <impl/common.hh>
+#include <impl/writer.hh>
+#include <impl/merge.hh>
+#include <impl/sort.hh>
+
+namespace yuliy_test_task::algorithm
+{
+  namespace detail
+  {
+    /**
+     * A temporary tape in the scratch directory, removed when it goes out of scope.
+     * It lives on the scratch device of the configuration.
+     */
+    template <typename T>
+    class ScratchTape
+    {
+      public:
+        explicit ScratchTape(Config const& config)
+          : path_(scratch_path(config))
+          , tape_(*create_binary_tape<T>(this->path_, config.device(TapeRole::Scratch)))
+        {}
+
+        ~ScratchTape() noexcept {
+          if(not this->tape_)
+            return;
+          this->tape_.reset();
+          [[maybe_unused]] auto dummy = std::error_code();
+          std::filesystem::remove(this->path_, dummy);
+        }
+
+        ScratchTape(ScratchTape const&) = delete;
+        ScratchTape& operator=(ScratchTape const&) = delete;
+        ScratchTape(ScratchTape&&) noexcept = default;
+        ScratchTape& operator=(ScratchTape&&) noexcept = delete;
+
+        [[nodiscard]] auto operator*() const -> ITape<T>& { return *this->tape_; }
+        [[nodiscard]] auto operator->() const -> ITape<T>* { return this->tape_.get(); }
+
+      private:
+        // like a tape that cannot open its file, a scratch directory that cannot be created throws
+        [[nodiscard]] static auto scratch_path(Config const& config) -> std::filesystem::path {
+          auto const directory = config.scratch().next_directory();
+          if(not directory)
+            throw std::runtime_error(directory.error());
+          return *directory / (common::random_string(32) + ".tape");
+        }
+
+        std::filesystem::path path_;
+        std::unique_ptr<ITape<T>> tape_;
+    };
+
+    /**
+     * A run that ends at the current head position of a tape, read backward with
+     * left shifts. It is a `RunCursor` source.
+     */
+    template <typename T>
+    class BackwardRun
+    {
+      public:
+        BackwardRun(ITape<T>& tape, std::size_t length)
+          : tape_(&tape)
+          , left_(length)
+        {}
+
+        [[nodiscard]] auto read_n(std::span<T> values) -> std::size_t {
+          auto const n = std::min(values.size(), this->left_);
+          for(std::size_t i = 0; i < n; ++i) {
+            std::ignore = this->tape_->shift(ITape<T>::Direction::Left);
+            values[i] = this->tape_->read();
+          }
+          this->left_ -= n;
+          return n;
+        }
+
+      private:
+        ITape<T>* tape_;
+        std::size_t left_;
+    };
+
+    /**
+     * A set of scratch tapes with the lengths of the runs stacked on each of them.
+     */
+    template <typename T>
+    struct TapeSet
+    {
+      TapeSet(Config const& config, std::size_t width) {
+        this->tapes.reserve(width);
+        for(std::size_t i = 0; i < width; ++i)
+          this->tapes.emplace_back(config);
+        this->runs.resize(width);
+      }
+
+      std::vector<ScratchTape<T>> tapes;
+      std::vector<std::vector<std::size_t>> runs;
+    };
+
+    /**
+     * Merges the topmost run of every tape in a set, reading them backward.
+     *
+     * \returns The number of merged values.
+     */
+    template <typename T, typename Sink, typename OnEmit>
+    auto merge_backward(
+      TapeSet<T>& from,
+      Sink& sink,
+      std::size_t cursor_budget,
+      bool ascending,
+      OnEmit&& on_emit,
+      MemoryBudget* budget = nullptr
+    ) -> std::size_t {
+      auto sources = std::vector<BackwardRun<T>>();
+      sources.reserve(from.tapes.size());
+      auto total = std::size_t(0);
+      for(std::size_t t = 0; t < from.tapes.size(); ++t) {
+        if(from.runs[t].empty())
+          continue;
+        sources.emplace_back(*from.tapes[t], from.runs[t].back());
+        total += from.runs[t].back();
+        from.runs[t].pop_back();
+      }
+      auto const block = cursor_block_elems<T>(cursor_budget, sources.size());
+      auto cursors = std::vector<RunCursor<T, BackwardRun<T>>>();
+      cursors.reserve(sources.size());
+      for(auto& source : sources)
+        cursors.emplace_back(source, block, budget);
+      if(ascending)
+        merge(cursors, sink, on_emit, std::less<>(), budget);
+      else
+        merge(cursors, sink, on_emit, std::greater<>(), budget);
+      return total;
+    }
+  } // namespace detail
+
+
+  /**
+   * Sorts the input tape with an oscillating merge that never rewinds its scratch tapes.
+   *
+   * Runs are written forward onto a set of `fan_in` scratch tapes. A merge pass
+   * reads them back from where the heads stopped, backward with left shifts, so
+   * every run comes out reversed; the merged runs are written forward onto a
+   * second set of tapes, whose heads were left at the beginning by the previous
+   * backward pass. The run direction therefore flips on every pass, and the
+   * initial runs are sorted so that the last pass reads them in ascending order
+   * into the output tape. No scratch tape is ever rewound.
+   *
+   * \param in The input tape.
+   * \param out The output tape.
+   * \param fan_in The number of scratch tapes in each set, at least 2.
+   * \param progress If true, the function prints progress information.
+   * \param scratch If not null, receives the operations performed on the scratch tapes.
+   * \returns An empty result if the function was successful, otherwise
+   * an std::unexpected with an error message.
+   */
+  template <typename T>
+  [[nodiscard]] auto sort_oscillating_into(
+    ITape<T>& in,
+    ITape<T>& out,
+    std::size_t fan_in,
+    bool progress = false,
+    TapeStats* scratch = nullptr
+  ) -> result_type<void> {
+    auto const max_elems_in_ram = in.config().template ram_limit_elems<typename ITape<T>::value_type>();
+    auto const size = in.size();
+    if(size == 0)
+      return {};
+    fan_in = std::max<std::size_t>(2, fan_in);
+    auto const run_count = (size + max_elems_in_ram - 1) / max_elems_in_ram;
+    auto passes = 0;
+    for(auto left = run_count; left > fan_in; left = (left + fan_in - 1) / fan_in)
+      ++passes;
+    auto const width = std::min(fan_in, run_count);
+    auto* const budget = &in.config().budget();
+    auto from = detail::TapeSet<T>(in.config(), width);
+    auto to = detail::TapeSet<T>(in.config(), width);
+    auto const collect = [&] {
+      if(scratch)
+        for(auto const* set : { &from, &to })
+          for(auto const& tape : set->tapes)
+            *scratch += tape->stats();
+    };
+
+    // the last pass must read descending runs backward, and every pass flips the direction
+    auto descending = passes % 2 == 0;
+    if(progress)
+      common::println("\nReading tape...");
+    auto block = budget_vector<T>(std::min(max_elems_in_ram, size), BudgetAllocator<T>(budget));
+    for(std::size_t consumed = 0, run = 0; consumed < size; ++run) {
+      auto const n = in.read_and_shift_n(std::span<T>(block).first(std::min(block.size(), size - consumed)));
+      if(not n)
+        return std::unexpected(n.error());
+      if(*n == 0)
+        break;
+      consumed += *n;
+      auto const data = std::span<T>(block).first(*n);
+      if(descending)
+        std::sort(data.begin(), data.end(), std::greater<>());
+      else
+        std::sort(data.begin(), data.end());
+      auto const t = run % width;
+      if(auto const res = from.tapes[t]->write_and_shift_n(data); not res)
+        return std::unexpected(res.error());
+      from.runs[t].push_back(data.size());
+      if(progress)
+        common::print_progress(run + 1, run_count);
+    }
+    block = budget_vector<T>(BudgetAllocator<T>(budget));
+    if(progress)
+      common::println();
+
+    for(auto pass = 1; pass <= passes; ++pass) {
+      if(progress)
+        common::println("\nMerge pass {}", pass);
+      for(std::size_t group = 0; not from.runs[0].empty(); ++group) {
+        auto const t = group % width;
+        auto sink = WriteBehindBuffer<T>(*to.tapes[t], max_elems_in_ram / 4, budget);
+        auto const length = detail::merge_backward(from, sink, max_elems_in_ram / 2, descending, [](std::size_t) {}, budget);
+        if(auto const res = sink.finish(); not res)
+          return std::unexpected(res.error());
+        to.runs[t].push_back(length);
+      }
+      std::swap(from, to);
+      descending = not descending;
+    }
+
+    if(progress)
+      common::println("\nSorting...");
+    auto sink = WriteBehindBuffer<T>(out, max_elems_in_ram / 4, budget);
+    auto written = std::size_t(0);
+    detail::merge_backward(from, sink, max_elems_in_ram / 2, true, [&](std::size_t n) {
+      written += n;
+      if(progress)
+        common::print_progress(written, size);
+    }, budget);
+    if(auto const res = sink.finish(); not res)
+      return std::unexpected(res.error());
+    collect();
+    if(progress)
+      common::println();
+    return {};
+  }
+} // namespace yuliy_test_task::algorithm
+
+#if defined UNIT_TESTS
+#include <gtest/gtest.h>
+
+TEST(Sort, oscillating_merge_without_rewinds)
+{
+  using namespace yuliy_test_task;
+  auto const config = *Config::from_pwd();
+  auto const path = std::filesystem::temp_directory_path() / std::format("yuliy_test_task_{}.tape", common::random_string(16));
+  auto scratch = TapeStats();
+  {
+    auto const in = *BinaryTape<int32_t>::create(common::canonicalize("../tests/test_input2.tape"), config);
+    auto const out = *BinaryTape<int32_t>::create(path, config);
+    ASSERT_TRUE(algorithm::sort_oscillating_into(*in, *out, 4, false, &scratch));
+  }
+  ASSERT_EQ(scratch.rewinds, 0);
+  auto const out = *BinaryTape<int32_t>::create(path, config);
+  auto const ref = *BinaryTape<int32_t>::create(common::canonicalize("../tests/test_output2.tape"), config);
+  ASSERT_EQ(out->size(), ref->size());
+  for(std::size_t i = 0; i < ref->size(); ++i)
+    ASSERT_EQ(out->read_and_shift(), ref->read_and_shift());
+  std::filesystem::remove(path);
+}
+#endif
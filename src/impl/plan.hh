@@ -0,0 +1,494 @@
+#pragma once
+
+#include <cmath>
+#include <chrono>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <ostream>
+#include <sstream>
+#include <format>
+#include <bit>
+#include <limits>
+#include <impl/itape.hh>
+#include <impl/config.hh>
+#include <impl/sort.hh>
+#include <impl/oscillating.hh>
+#include <impl/distribution.hh>
+
+namespace yuliy_test_task::algorithm
+{
+  /**
+   * The external sorting strategies the planner can choose from.
+   */
+  enum class Strategy
+  {
+    InRam,
+    SinglePassMerge,
+    MultiPassMerge,
+    OscillatingMerge,
+    Counting,
+    Distribution
+  };
+
+  [[nodiscard]] constexpr auto to_string(Strategy strategy) -> std::string_view {
+    switch(strategy) {
+      case Strategy::InRam: return "in-ram";
+      case Strategy::SinglePassMerge: return "single-pass merge";
+      case Strategy::MultiPassMerge: return "multi-pass merge";
+      case Strategy::OscillatingMerge: return "oscillating merge";
+      case Strategy::Counting: return "counting";
+      case Strategy::Distribution: return "distribution";
+    }
+    return "unknown";
+  }
+
+  /**
+   * The inclusive range of keys on a tape, when it is known in advance.
+   */
+  template <typename T>
+  struct KeyRange
+  {
+    T lo;
+    T hi;
+  };
+
+  /**
+   * The predicted cost of running one strategy.
+   *
+   * `modeled` is the time the tape model charges for every element moved on the
+   * input, output and temporary tapes, each priced by the device it lives on. `wall` is the expected run time of this
+   * emulator: the delays charged on the emulated tapes, plus the CPU work and the
+   * disk traffic of temporary runs that live in plain files.
+   */
+  struct Estimate
+  {
+    Strategy strategy;
+    bool feasible = true;
+    std::string note = {};
+    std::size_t passes = 0;
+    std::size_t fan_in = 0;
+    TapeStats input;
+    TapeStats output;
+    TapeStats scratch = {};
+    std::chrono::microseconds modeled = {};
+    std::chrono::microseconds wall = {};
+  };
+
+  /**
+   * The estimates of every strategy for one tape and the one chosen to run.
+   */
+  template <typename T>
+  struct Plan
+  {
+    std::size_t size;
+    std::optional<KeyRange<T>> key_range;
+    std::vector<Estimate> candidates;
+    std::size_t chosen;
+
+    [[nodiscard]] auto best() const -> Estimate const& { return this->candidates[this->chosen]; }
+  };
+
+  namespace detail
+  {
+    /**
+     * The CPU cost of one key comparison, used for the wall time estimate.
+     */
+    inline constexpr auto compare_cost = std::chrono::duration<double, std::micro>(0.002);
+
+    /**
+     * The sequential bandwidth of the scratch directory in bytes per microsecond.
+     */
+    inline constexpr auto scratch_bytes_per_us = 1024.0;
+
+    [[nodiscard]] inline auto log2_ceil(std::size_t n) -> double {
+      return n <= 1 ? 0.0 : std::ceil(std::log2(static_cast<double>(n)));
+    }
+
+    /**
+     * Completes an estimate with its modeled and wall times.
+     *
+     * For the streaming model the head passes every shifted value, and a drive
+     * stops whenever the sort stops feeding it: after every block the input and
+     * output tapes exchange with the write-behind buffers, a quarter of the RAM
+     * limit, and, for scratch on tapes, after every block a merge cursor reads.
+     * Every tape is priced with the device profile of its role.
+     *
+     * \param scratch_block The elements a merge cursor reads at once if the scratch
+     * is on tapes, zero if it is in temporary files.
+     */
+    template <typename T>
+    auto finish_estimate(Estimate& e, Config const& config, double compares, std::size_t scratch_block = 0) -> void {
+      auto const staging = std::max<std::size_t>(1, config.template ram_limit_elems<T>() / 4);
+      auto const scratch_on_tapes = scratch_block != 0;
+      // with blocks, tapes charge and count their operations per block
+      auto const per_block = [](TapeStats& stats, Config const& device) {
+        if(auto const block_elems = device.block_size() / sizeof(T); block_elems > 1)
+          for(auto* op : { &stats.reads, &stats.writes, &stats.shifts })
+            *op = (*op + block_elems - 1) / block_elems;
+      };
+      for(auto* stats : { &e.input, &e.output }) {
+        stats->bytes = stats->shifts * sizeof(T);
+        stats->stalls = stats->rewinds + stats->shifts / staging;
+      }
+      e.scratch.bytes = e.scratch.shifts * sizeof(T);
+      if(scratch_on_tapes)
+        e.scratch.stalls = e.scratch.rewinds + e.scratch.reads / scratch_block + e.scratch.writes / staging;
+      auto const& input = config.device(TapeRole::Input);
+      auto const& output = config.device(TapeRole::Output);
+      auto const& scratch = config.device(TapeRole::Scratch);
+      per_block(e.input, input);
+      per_block(e.output, output);
+      if(scratch_on_tapes)
+        per_block(e.scratch, scratch);
+      auto const tapes = e.input.modeled_time(input) + e.output.modeled_time(output);
+      e.modeled = tapes + e.scratch.modeled_time(scratch);
+      auto const scratch_bytes = static_cast<double>(e.scratch.bytes);
+      auto const wall = std::chrono::duration<double, std::micro>(tapes)
+        + compare_cost * compares
+        + std::chrono::duration<double, std::micro>(scratch_bytes / scratch_bytes_per_us)
+        + std::chrono::duration<double, std::micro>(scratch_on_tapes ? e.scratch.modeled_time(scratch) : std::chrono::microseconds());
+      e.wall = std::chrono::duration_cast<std::chrono::microseconds>(wall);
+    }
+  } // namespace detail
+
+  /**
+   * Estimates the cost of every strategy and picks the cheapest feasible one.
+   *
+   * Every strategy writes the output tape exactly once and reads the input tape
+   * once, but for the sampled distribution, which reads it twice; they differ in
+   * how many times the data crosses the temporary tapes and in how much memory
+   * they need. With device profiles, passes over a fast scratch device cost less
+   * than a pass over a slow input tape. A strategy is feasible if its working set fits in
+   * the RAM limit. The cheapest modeled cost wins, ties are broken by wall time.
+   *
+   * \param config The configuration of the tapes.
+   * \param size The number of elements on the input tape.
+   * \param key_range The range of keys on the input tape, if known.
+   * \returns The plan.
+   */
+  template <typename T>
+  [[nodiscard]] auto make_plan(
+    Config const& config,
+    std::size_t size,
+    std::optional<KeyRange<T>> key_range = std::nullopt
+  ) -> Plan<T> {
+    auto const m = std::max<std::size_t>(1, config.template ram_limit_elems<T>());
+    auto const n = size;
+    auto const runs = std::max<std::size_t>(1, (n + m - 1) / m);
+    auto const max_fan_in = detail::max_fan_in(m);
+    auto const read_once = TapeStats { .reads = n, .writes = 0, .shifts = n, .rewinds = 0 };
+    auto const write_once = TapeStats { .reads = 0, .writes = n, .shifts = n, .rewinds = 0 };
+    auto plan = Plan<T> { .size = size, .key_range = key_range, .candidates = {}, .chosen = 0 };
+
+    {
+      auto e = Estimate { .strategy = Strategy::InRam, .passes = 1, .fan_in = 1, .input = read_once, .output = write_once };
+      if(n > m) {
+        e.feasible = false;
+        e.note = std::format("needs {} elements of ram, have {}", n, m);
+      }
+      detail::finish_estimate<T>(e, config, static_cast<double>(n) * detail::log2_ceil(n));
+      plan.candidates.push_back(std::move(e));
+    }
+    {
+      auto e = Estimate { .strategy = Strategy::SinglePassMerge, .passes = 2, .fan_in = runs, .input = read_once, .output = write_once };
+      e.scratch = TapeStats { .reads = n, .writes = n, .shifts = 2 * n, .rewinds = runs };
+      if(runs > max_fan_in) {
+        e.feasible = false;
+        e.note = std::format("{} runs exceed the fan-in limit of {}", runs, max_fan_in);
+      } else
+        e.note = std::format("{} runs", runs);
+      detail::finish_estimate<T>(e, config, static_cast<double>(n) * (detail::log2_ceil(m) + detail::log2_ceil(runs)));
+      plan.candidates.push_back(std::move(e));
+    }
+    {
+      auto merge_passes = std::size_t(1);
+      auto rewinds = runs;
+      for(auto left = runs; left > max_fan_in; left = (left + max_fan_in - 1) / max_fan_in) {
+        ++merge_passes;
+        rewinds += (left + max_fan_in - 1) / max_fan_in;
+      }
+      auto e = Estimate { .strategy = Strategy::MultiPassMerge, .passes = merge_passes + 1, .fan_in = max_fan_in, .input = read_once, .output = write_once };
+      e.scratch = TapeStats { .reads = n * merge_passes, .writes = n * merge_passes, .shifts = 2 * n * merge_passes, .rewinds = rewinds };
+      if(merge_passes == 1) {
+        e.feasible = false;
+        e.note = "a single merge pass is enough";
+      } else
+        e.note = std::format("{} runs, {} merge passes", runs, merge_passes);
+      auto const compares = static_cast<double>(n) * (detail::log2_ceil(m) + static_cast<double>(merge_passes) * detail::log2_ceil(max_fan_in));
+      detail::finish_estimate<T>(e, config, compares);
+      plan.candidates.push_back(std::move(e));
+    }
+    {
+      auto merge_passes = std::size_t(1);
+      for(auto left = runs; left > max_fan_in; left = (left + max_fan_in - 1) / max_fan_in)
+        ++merge_passes;
+      auto e = Estimate { .strategy = Strategy::OscillatingMerge, .passes = merge_passes + 1, .fan_in = max_fan_in, .input = read_once, .output = write_once };
+      auto const width = std::min(runs, max_fan_in);
+      e.scratch = TapeStats { .reads = n * merge_passes, .writes = n * merge_passes, .shifts = 2 * n * merge_passes, .rewinds = 0 };
+      // every pass reads back the tapes it wrote, so each of them reverses once
+      e.scratch.reversals = merge_passes * width;
+      e.note = std::format("{} runs, {} merge passes, {} scratch tapes", runs, merge_passes, 2 * width);
+      auto const compares = static_cast<double>(n) * (detail::log2_ceil(m) + static_cast<double>(merge_passes) * detail::log2_ceil(width));
+      detail::finish_estimate<T>(e, config, compares, detail::cursor_block_elems<T>(m / 2, width));
+      plan.candidates.push_back(std::move(e));
+    }
+    {
+      auto e = Estimate { .strategy = Strategy::Counting, .passes = 1, .fan_in = 1, .input = read_once, .output = write_once };
+      if constexpr(std::integral<T>) {
+        if(not key_range) {
+          e.feasible = false;
+          e.note = "needs a key range";
+        } else {
+          auto const range = static_cast<std::size_t>(static_cast<std::int64_t>(key_range->hi) - static_cast<std::int64_t>(key_range->lo)) + 1;
+          e.feasible = key_range->lo <= key_range->hi and range * detail::counter_bytes(n) <= config.ram_limit_bytes() / 2;
+          e.note = e.feasible ? std::format("{} keys", range) : std::format("counters for {} keys do not fit in ram", range);
+        }
+      } else {
+        e.feasible = false;
+        e.note = "keys are not integers";
+      }
+      detail::finish_estimate<T>(e, config, static_cast<double>(n));
+      plan.candidates.push_back(std::move(e));
+    }
+    {
+      auto e = Estimate { .strategy = Strategy::Distribution, .passes = 1, .fan_in = detail::distribution_buckets(m), .input = read_once, .output = write_once };
+      if constexpr(std::integral<T> and sizeof(T) <= sizeof(std::uint32_t)) {
+        // with a key range the high bits are assumed to spread the keys evenly, without
+        // one the input is sampled first and the splitters balance the buckets
+        auto width = key_range
+          ? static_cast<std::uint64_t>(static_cast<std::int64_t>(key_range->hi) - static_cast<std::int64_t>(key_range->lo)) + 1
+          : std::numeric_limits<std::uint64_t>::max();
+        auto const bucket_bits = static_cast<std::size_t>(std::countr_zero(e.fan_in));
+        auto levels = std::size_t(0);
+        auto buckets = std::size_t(0);
+        for(std::size_t nodes = 1, left = n; left > m / 4 and width > 1; ++levels) {
+          auto const bits = static_cast<std::size_t>(std::bit_width(width - 1));
+          auto const shift = bits > bucket_bits ? bits - bucket_bits : 0;
+          auto const used = static_cast<std::size_t>(((width - 1) >> shift) + 1);
+          buckets += nodes * used;
+          nodes *= used;
+          left = (left + used - 1) / used;
+          width = std::uint64_t(1) << shift;
+        }
+        if(not key_range) {
+          e.input += TapeStats { .reads = n, .writes = 0, .shifts = n, .rewinds = 1 };
+          ++e.passes;
+        }
+        e.passes += levels;
+        e.scratch = TapeStats { .reads = n * levels, .writes = n * levels, .shifts = 2 * n * levels, .rewinds = buckets };
+        e.note = std::format("{} levels, {} buckets{}", levels, buckets, key_range ? "" : ", sampled splitters");
+        detail::finish_estimate<T>(e, config, static_cast<double>(n) * (static_cast<double>(levels) + detail::log2_ceil(m / 4)));
+      } else {
+        e.feasible = false;
+        e.note = "keys are not 32-bit integers";
+        detail::finish_estimate<T>(e, config, static_cast<double>(n));
+      }
+      plan.candidates.push_back(std::move(e));
+    }
+
+    // the strategies with temporary runs need a few blocks of at least one element
+    for(auto& e : plan.candidates) {
+      auto const min_elems = e.strategy == Strategy::InRam or e.strategy == Strategy::Counting ? 0
+        : e.strategy == Strategy::Distribution ? detail::min_distribution_elems
+        : detail::min_merge_elems;
+      if(m < min_elems) {
+        e.feasible = false;
+        e.note = std::format("needs at least {} bytes of ram", min_elems * sizeof(T));
+      }
+    }
+
+    auto const better = [](Estimate const& lhs, Estimate const& rhs) {
+      if(lhs.feasible != rhs.feasible)
+        return lhs.feasible;
+      if(lhs.modeled != rhs.modeled)
+        return lhs.modeled < rhs.modeled;
+      return lhs.wall < rhs.wall;
+    };
+    for(std::size_t i = 1; i < plan.candidates.size(); ++i)
+      if(better(plan.candidates[i], plan.candidates[plan.chosen]))
+        plan.chosen = i;
+    return plan;
+  }
+
+  /**
+   * Runs the strategy chosen by a plan.
+   *
+   * The external merge is called with the concrete types of the tapes, so it
+   * runs without virtual dispatch when they are final.
+   *
+   * \param plan The plan made for the input tape.
+   * \param in The input tape.
+   * \param out The output tape.
+   * \param progress If true, the function prints progress information.
+   * \param scratch If not null, receives the operations performed on temporary tapes and runs.
+   * \returns An empty result if the function was successful, otherwise
+   * an std::unexpected with an error message.
+   */
+  template <typename T, std::derived_from<ITape<T>> In, std::derived_from<ITape<T>> Out>
+  [[nodiscard]] auto execute(
+    Plan<T> const& plan,
+    In& in,
+    Out& out,
+    bool progress = false,
+    TapeStats* scratch = nullptr
+  ) -> result_type<void> {
+    switch(plan.best().strategy) {
+      case Strategy::InRam:
+        return sort_in_ram_into<T>(in, out, progress);
+      case Strategy::SinglePassMerge:
+        return sort_into(in, out, progress, scratch);
+      case Strategy::MultiPassMerge:
+        return sort_multi_pass_into<T>(in, out, plan.best().fan_in, progress, scratch);
+      case Strategy::OscillatingMerge:
+        return sort_oscillating_into<T>(in, out, plan.best().fan_in, progress, scratch);
+      case Strategy::Counting:
+        if constexpr(std::integral<T>)
+          return sort_counting_into<T>(in, out, plan.key_range->lo, plan.key_range->hi, progress, scratch);
+        break;
+      case Strategy::Distribution:
+        if constexpr(std::integral<T> and sizeof(T) <= sizeof(std::uint32_t)) {
+          if(plan.key_range)
+            return sort_distribution_into<T>(in, out, plan.key_range->lo, plan.key_range->hi, progress, scratch);
+          return sort_sampled_distribution_into<T>(in, out, progress, scratch);
+        }
+        break;
+    }
+    return std::unexpected(std::format("strategy {} cannot run on this tape", to_string(plan.best().strategy)));
+  }
+
+  template <typename T>
+  auto operator<<(std::ostream& os, Plan<T> const& self) -> std::ostream& {
+    os << std::format("plan for {} elements:\n", self.size);
+    for(std::size_t i = 0; i < self.candidates.size(); ++i) {
+      auto const& e = self.candidates[i];
+      os << std::format("  {} {:<18} {:<10} modeled {:>12} wall {:>12}  {}\n",
+        i == self.chosen ? '*' : ' ',
+        to_string(e.strategy),
+        e.feasible ? "feasible" : "infeasible",
+        e.modeled,
+        e.wall,
+        e.note
+      );
+    }
+    return os;
+  }
+} // namespace yuliy_test_task::algorithm
+
+template <typename T>
+struct std::formatter<yuliy_test_task::algorithm::Plan<T>, char>
+{
+  template <typename ParseContext>
+  constexpr auto parse(ParseContext& ctx) -> ParseContext::iterator { return ctx.begin(); }
+
+  template <typename FormatContext>
+  auto format(yuliy_test_task::algorithm::Plan<T> const& plan, FormatContext& ctx) const -> FormatContext::iterator {
+    auto os = std::stringstream();
+    os << plan;
+    return std::ranges::copy(std::move(os).str(), ctx.out()).out;
+  }
+};
+
+#if defined UNIT_TESTS
+#include <fstream>
+#include <gtest/gtest.h>
+#include <impl/tape.hh>
+
+TEST(Plan, picks_feasible_strategy_for_tape_size)
+{
+  using namespace yuliy_test_task::algorithm;
+  auto const config = *yuliy_test_task::Config::from_pwd();
+  auto const m = config.ram_limit_elems<int32_t>();
+  ASSERT_EQ(make_plan<int32_t>(config, m).best().strategy, Strategy::InRam);
+  ASSERT_EQ(make_plan<int32_t>(config, 10 * m).best().strategy, Strategy::OscillatingMerge);
+  ASSERT_FALSE(make_plan<int32_t>(config, 1000 * m).candidates[static_cast<int>(Strategy::SinglePassMerge)].feasible);
+  ASSERT_TRUE(make_plan<int32_t>(config, 1000 * m).candidates[static_cast<int>(Strategy::MultiPassMerge)].feasible);
+  ASSERT_EQ(make_plan<int32_t>(config, 10 * m, KeyRange<int32_t> { 1, 1000 }).best().strategy, Strategy::Counting);
+  ASSERT_EQ(make_plan<int32_t>(config, 10 * m).candidates[static_cast<int>(Strategy::Distribution)].passes, 3);
+}
+
+TEST(Plan, prices_tapes_with_their_device_profiles)
+{
+  using namespace yuliy_test_task;
+  using namespace yuliy_test_task::algorithm;
+  auto const load = [](std::string_view text) {
+    auto const path = std::filesystem::temp_directory_path() / std::format("yuliy_test_task_{}.ini", common::random_string(16));
+    std::ofstream(path) << text;
+    auto config = Config::load(path);
+    std::filesystem::remove(path);
+    return config;
+  };
+  auto const devices = "ram_limit = 10240\nread_delay = 0\nwrite_delay = 0\ntape_shift_delay = 1\n"
+    "[slow]\ntape_shift_delay = 100\ntape_rewind_delay = 10000\n"
+    "[nvme]\ntape_shift_delay = 0\ntape_rewind_delay = 0\n";
+  auto const base = *load(devices);
+  auto const config = *load(std::format("input_profile = slow\nscratch_profile = nvme\n{}", devices));
+  ASSERT_EQ(&base.device(TapeRole::Input), &base);
+  ASSERT_EQ(config.device(TapeRole::Input).tape_shift_delay(), 100us);
+  ASSERT_EQ(config.device(TapeRole::Output).tape_shift_delay(), 1us);
+  ASSERT_EQ(config.device(TapeRole::Scratch).profile(), "nvme");
+  ASSERT_EQ(&config.device(TapeRole::Input).device(TapeRole::Scratch), &config.device(TapeRole::Scratch));
+  ASSERT_FALSE(load("output_profile = missing\n"));
+
+  // reading the slow input twice costs more than merging on the fast scratch
+  auto const m = config.ram_limit_elems<int32_t>();
+  auto const gap = [&](Config const& c) {
+    auto const plan = make_plan<int32_t>(c, 10 * m);
+    return plan.candidates[static_cast<int>(Strategy::Distribution)].modeled
+      - plan.candidates[static_cast<int>(Strategy::OscillatingMerge)].modeled;
+  };
+  ASSERT_GT(gap(config), gap(base));
+  auto const oscillating = make_plan<int32_t>(config, 10 * m).candidates[static_cast<int>(Strategy::OscillatingMerge)];
+  ASSERT_EQ(oscillating.modeled, 10 * m * (100us + 1us));
+}
+
+TEST(Plan, feasible_strategies_run_within_small_ram_limits)
+{
+  using namespace yuliy_test_task;
+  using namespace yuliy_test_task::algorithm;
+  auto values = std::vector<int32_t>(3000);
+  for(std::size_t i = 0; i < values.size(); ++i)
+    values[i] = static_cast<int32_t>((i * 7919) % 1000);
+  auto const in_path = std::filesystem::temp_directory_path() / std::format("yuliy_test_task_{}.tape", common::random_string(16));
+  auto const out_path = std::filesystem::temp_directory_path() / std::format("yuliy_test_task_{}.tape", common::random_string(16));
+  std::ofstream(in_path, std::ios::binary).write(reinterpret_cast<char const*>(values.data()), static_cast<std::streamsize>(values.size() * sizeof(int32_t)));
+  std::ranges::sort(values);
+  for(auto const ram_limit : { 8, 16, 20, 40, 128, 1024 }) {
+    auto const ini = std::filesystem::temp_directory_path() / std::format("yuliy_test_task_{}.ini", common::random_string(16));
+    std::ofstream(ini) << std::format("ram_limit = {}\n", ram_limit);
+    auto const config = *Config::load(ini);
+    std::filesystem::remove(ini);
+    for(auto const key_range : { std::optional<KeyRange<int32_t>>(), std::optional(KeyRange<int32_t> { 0, 999 }) }) {
+      auto plan = make_plan<int32_t>(config, values.size(), key_range);
+      for(std::size_t i = 0; i < plan.candidates.size(); ++i) {
+        auto const& e = plan.candidates[i];
+        if(ram_limit == 16 and e.strategy == Strategy::Distribution) {
+          ASSERT_EQ(e.note, "needs at least 20 bytes of ram");
+        }
+        if(ram_limit == 8 and e.strategy == Strategy::MultiPassMerge) {
+          ASSERT_EQ(e.note, "needs at least 16 bytes of ram");
+        }
+        if(ram_limit == 8 and e.strategy != Strategy::InRam and e.strategy != Strategy::Counting) {
+          ASSERT_FALSE(e.feasible) << to_string(e.strategy);
+        }
+        if(not e.feasible)
+          continue;
+        plan.chosen = i;
+        SCOPED_TRACE(std::format("{} bytes, {}", ram_limit, to_string(e.strategy)));
+        {
+          auto const in = *BinaryTape<int32_t, NoDelay>::open(in_path, config);
+          auto const out = *BinaryTape<int32_t, NoDelay>::open(out_path, config);
+          auto const res = execute(plan, *in, *out);
+          ASSERT_TRUE(res) << res.error();
+        }
+        auto sorted = std::vector<int32_t>(values.size());
+        std::ifstream(out_path, std::ios::binary).read(reinterpret_cast<char*>(sorted.data()), static_cast<std::streamsize>(sorted.size() * sizeof(int32_t)));
+        ASSERT_EQ(sorted, values);
+      }
+    }
+  }
+  std::filesystem::remove(in_path);
+  std::filesystem::remove(out_path);
+}
+#endif
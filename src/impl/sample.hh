@@ -0,0 +1,120 @@
+#pragma once
+
+#include <vector>
+#include <random>
+#include <limits>
+#include <cstdint>
+#include <concepts>
+#include <algorithm>
+#include <span>
+#include <impl/itape.hh>
+#include <impl/memory.hh>
+#include <impl/common.hh>
+
+namespace yuliy_test_task::algorithm
+{
+  /**
+   * Takes a uniform random sample of the keys on a tape.
+   *
+   * The tape is read once from its current position to the end with bulk reads,
+   * keeping a reservoir of `k` keys: every key read so far has the same chance to
+   * be in it. The tape is left at its end; rewind it, possibly with `rewind_async`
+   * while the sample is being used, before sorting it.
+   *
+   * \param in The tape to sample, positioned at its beginning.
+   * \param k The size of the sample, which is also its memory budget in elements.
+   * \param seed The seed of the random generator, fixed by default to make runs reproducible.
+   * \returns At most `k` keys in no particular order, charged to the memory budget
+   * of the tape, otherwise an std::unexpected with an error message.
+   */
+  template <typename T>
+  [[nodiscard]] auto reservoir_sample(
+    ITape<T>& in,
+    std::size_t k,
+    std::uint64_t seed = 0x5eed
+  ) -> std::expected<budget_vector<T>, std::string> {
+    auto const size = in.size();
+    auto const chunk = std::max<std::size_t>(1, in.config().template ram_limit_elems<T>() / 8);
+    auto rng = std::mt19937_64(seed);
+    auto sample = budget_vector<T>(BudgetAllocator<T>(&in.config().budget()));
+    sample.reserve(std::min(k, size));
+    auto block = budget_vector<T>(std::min(chunk, size), BudgetAllocator<T>(&in.config().budget()));
+    for(std::size_t seen = 0; seen < size;) {
+      auto const n = in.read_and_shift_n(std::span<T>(block).first(std::min(block.size(), size - seen)));
+      if(not n)
+        return std::unexpected(n.error());
+      if(*n == 0)
+        break;
+      for(auto const value : std::span<T const>(block).first(*n)) {
+        if(sample.size() < k)
+          sample.push_back(value);
+        else if(auto const j = std::uniform_int_distribution<std::size_t>(0, seen)(rng); j < k)
+          sample[j] = value;
+        ++seen;
+      }
+    }
+    return sample;
+  }
+
+  /**
+   * Picks splitters that cut the keys into buckets of about the same size.
+   *
+   * The splitters are the `buckets`-quantiles of the sample. A key that fills more
+   * than one quantile on its own, such as the head of a Zipf distribution, gets
+   * a bucket of its own: both the key and its predecessor become splitters, so
+   * the bucket `(key - 1, key]` holds nothing else and needs no sorting.
+   *
+   * \param sample The sample of the keys, sorted in place.
+   * \param buckets The number of buckets wanted.
+   * \returns At most `buckets - 1` strictly increasing splitters, all smaller than
+   * the largest value of T.
+   */
+  template <std::integral T>
+  [[nodiscard]] auto quantile_splitters(std::span<T> sample, std::size_t buckets) -> std::vector<T> {
+    auto splitters = std::vector<T>();
+    if(sample.empty() or buckets < 2)
+      return splitters;
+    std::ranges::sort(sample);
+    auto const k = sample.size();
+    auto const push = [&](T key) {
+      if(splitters.size() + 1 < buckets and key != std::numeric_limits<T>::max() and (splitters.empty() or splitters.back() < key))
+        splitters.push_back(key);
+    };
+    for(std::size_t i = 1; i < buckets; ++i) {
+      auto const key = sample[i * k / buckets];
+      auto const [first, last] = std::ranges::equal_range(sample, key);
+      if(static_cast<std::size_t>(last - first) * buckets > k and key != std::numeric_limits<T>::min())
+        push(key - 1);
+      push(key);
+    }
+    return splitters;
+  }
+} // namespace yuliy_test_task::algorithm
+
+#if defined UNIT_TESTS
+#include <gtest/gtest.h>
+
+TEST(Sample, quantile_splitters_balance_skewed_keys)
+{
+  using namespace yuliy_test_task::algorithm;
+  // a Zipf-like sample: key 1 is half of it, the rest are distinct
+  auto sample = std::vector<int32_t>(500, 1);
+  for(auto key = 2; key <= 501; ++key)
+    sample.push_back(key);
+  auto const buckets = std::size_t(8);
+  auto const splitters = quantile_splitters(std::span(sample), buckets);
+  ASSERT_LT(splitters.size(), buckets);
+  ASSERT_TRUE(std::ranges::is_sorted(splitters));
+  ASSERT_TRUE(std::ranges::binary_search(splitters, 0));
+  ASSERT_TRUE(std::ranges::binary_search(splitters, 1));
+  auto sizes = std::vector<std::size_t>(splitters.size() + 1);
+  for(auto const key : sample)
+    ++sizes[std::ranges::lower_bound(splitters, key) - splitters.begin()];
+  for(std::size_t b = 0; b < sizes.size(); ++b) {
+    auto const single_key = b > 0 and b < splitters.size() and splitters[b - 1] + 1 == splitters[b];
+    if(not single_key) {
+      ASSERT_LE(sizes[b], 2 * sample.size() / buckets);
+    }
+  }
+}
+#endif
@@ -0,0 +1,696 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <expected>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <utility>
+#include <vector>
+#include <impl/common.hh>
+#if defined __linux__
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace yuliy_test_task
+{
+  /**
+   * The places a temporary run can live in, from the fastest to the slowest.
+   */
+  enum class ScratchTier
+  {
+    Memory,  ///< a buffer of this process
+    Memfd,   ///< an anonymous in-memory file, on Linux
+    Disk     ///< a file in the scratch directory
+  };
+
+  [[nodiscard]] constexpr auto to_string(ScratchTier tier) -> std::string_view {
+    switch(tier) {
+      case ScratchTier::Memory: return "memory";
+      case ScratchTier::Memfd: return "memfd";
+      case ScratchTier::Disk: return "disk";
+    }
+    return "unknown";
+  }
+
+  /**
+   * How the disk tier picks the directory of a new file.
+   */
+  enum class ScratchPlacement
+  {
+    RoundRobin,  ///< the directories in turn
+    FreeSpace    ///< the directory with the most free space
+  };
+
+  [[nodiscard]] constexpr auto to_string(ScratchPlacement placement) -> std::string_view {
+    switch(placement) {
+      case ScratchPlacement::RoundRobin: return "round_robin";
+      case ScratchPlacement::FreeSpace: return "free_space";
+    }
+    return "unknown";
+  }
+
+  /**
+   * The storage shared by the temporary runs of a sort, split into tiers.
+   *
+   * The memory and memfd tiers have limits of their own, separate from the RAM
+   * limit of the keys; the disk tier is only limited by the scratch directory.
+   * Runs reserve the bytes they grow by in their tier and give them back when
+   * they are removed, so a tier is reused as soon as runs are merged.
+   *
+   * The disk tier can be striped over several directories, one per scratch
+   * volume: every new file goes to the next one, so the runs a merge reads at
+   * once are spread over all volumes.
+   *
+   * On Linux the files of the disk tier are pooled: a removed run gives its file
+   * back with the extents `fallocate` reserved for it, and the next run placed in
+   * the same directory reuses it instead of creating, growing and unlinking a
+   * file of its own. The pooled files are removed with the space.
+   */
+  class ScratchSpace
+  {
+    public:
+      static constexpr std::size_t tier_count = 3;
+
+      /**
+       * @param memory_limit The bytes runs may keep in the memory of this process.
+       * @param memfd_limit The bytes runs may keep in anonymous in-memory files.
+       * @param directories The directories of the runs on disk, at least one.
+       * @param placement How a directory is picked for a new file.
+       * @param pool_files The most files of the disk tier kept for reuse.
+       * @param extent_bytes The granularity files of the disk tier are preallocated in.
+       */
+      ScratchSpace(
+        std::size_t memory_limit,
+        std::size_t memfd_limit,
+        std::vector<std::filesystem::path> directories,
+        ScratchPlacement placement = ScratchPlacement::RoundRobin,
+        std::size_t pool_files = 64,
+        std::size_t extent_bytes = std::size_t(1) << 20
+      )
+        : directories_(std::move(directories))
+        , placed_(std::make_unique<std::atomic<std::size_t>[]>(this->directories_.size()))
+        , placement_(placement)
+        , pools_(this->directories_.size())
+        , pool_files_(pool_files)
+        , extent_bytes_(std::max<std::size_t>(1, extent_bytes))
+      {
+        this->tiers_[static_cast<std::size_t>(ScratchTier::Memory)].limit = memory_limit;
+#if defined __linux__
+        this->tiers_[static_cast<std::size_t>(ScratchTier::Memfd)].limit = memfd_limit;
+#else
+        static_cast<void>(memfd_limit);
+#endif
+        this->tiers_[static_cast<std::size_t>(ScratchTier::Disk)].limit = static_cast<std::size_t>(-1);
+      }
+
+      ~ScratchSpace() noexcept {
+#if defined __linux__
+        for(auto& pool : this->pools_)
+          for(auto const& file : pool) {
+            ::close(file.fd);
+            [[maybe_unused]] auto dummy = std::error_code();
+            std::filesystem::remove(file.path, dummy);
+          }
+#endif
+      }
+
+      ScratchSpace(ScratchSpace const&) = delete;
+      ScratchSpace& operator=(ScratchSpace const&) = delete;
+
+      /**
+       * A file of the disk tier with the bytes preallocated for it.
+       */
+      struct DiskFile
+      {
+        std::filesystem::path path;
+        int fd = -1;
+        std::size_t allocated = 0;
+        std::size_t directory = 0;
+      };
+
+      /**
+       * Reserves bytes in a tier if they fit in its limit.
+       *
+       * @param tier The tier.
+       * @param bytes The number of bytes.
+       * @return `true` if the bytes were reserved, `false` if the tier is full.
+       */
+      [[nodiscard]] auto try_reserve(ScratchTier tier, std::size_t bytes) noexcept -> bool {
+        auto& self = this->tiers_[static_cast<std::size_t>(tier)];
+        auto used = self.used.load(std::memory_order_relaxed);
+        do {
+          if(bytes > self.limit - used)
+            return false;
+        } while(not self.used.compare_exchange_weak(used, used + bytes, std::memory_order_relaxed));
+        raise_peak(self.peak, used + bytes);
+        raise_peak(this->total_peak_, this->total_used_.fetch_add(bytes, std::memory_order_relaxed) + bytes);
+        return true;
+      }
+
+      /**
+       * Gives back bytes reserved in a tier.
+       *
+       * @param tier The tier.
+       * @param bytes The number of bytes.
+       */
+      auto release(ScratchTier tier, std::size_t bytes) noexcept -> void {
+        this->tiers_[static_cast<std::size_t>(tier)].used.fetch_sub(bytes, std::memory_order_relaxed);
+        this->total_used_.fetch_sub(bytes, std::memory_order_relaxed);
+      }
+
+      /**
+       * Counts a run that outgrew its tier and was moved to a slower one.
+       */
+      auto count_spill() noexcept -> void { this->spills_.fetch_add(1, std::memory_order_relaxed); }
+
+      [[nodiscard]] auto limit(ScratchTier tier) const noexcept -> std::size_t {
+        return this->tiers_[static_cast<std::size_t>(tier)].limit;
+      }
+
+      [[nodiscard]] auto used(ScratchTier tier) const noexcept -> std::size_t {
+        return this->tiers_[static_cast<std::size_t>(tier)].used.load(std::memory_order_relaxed);
+      }
+
+      /**
+       * Returns the largest number of bytes a tier has held at once.
+       *
+       * @param tier The tier.
+       * @return The peak usage of the tier in bytes.
+       */
+      [[nodiscard]] auto peak(ScratchTier tier) const noexcept -> std::size_t {
+        return this->tiers_[static_cast<std::size_t>(tier)].peak.load(std::memory_order_relaxed);
+      }
+
+      /**
+       * Returns the largest number of bytes all tiers have held at once.
+       *
+       * @return The peak scratch usage in bytes.
+       */
+      [[nodiscard]] auto peak_total() const noexcept -> std::size_t { return this->total_peak_.load(std::memory_order_relaxed); }
+
+      /**
+       * Returns the granularity files of the disk tier are preallocated and reclaimed in.
+       *
+       * @return The extent size in bytes.
+       */
+      [[nodiscard]] auto extent_bytes() const noexcept -> std::size_t { return this->extent_bytes_; }
+
+      /**
+       * Returns how many runs were moved to a slower tier while they were written.
+       *
+       * @return The number of spills.
+       */
+      [[nodiscard]] auto spills() const noexcept -> std::size_t { return this->spills_.load(std::memory_order_relaxed); }
+
+      /**
+       * Picks the directory of a new file on disk and creates it if needed.
+       *
+       * @return The directory, otherwise an std::unexpected with an error message.
+       */
+      [[nodiscard]] auto next_directory() -> std::expected<std::filesystem::path, std::string> {
+        auto const index = this->prepare_directory();
+        if(not index)
+          return std::unexpected(index.error());
+        return this->directories_[*index];
+      }
+
+#if defined __linux__
+      /**
+       * Hands out a file of the disk tier, a pooled one if its directory has any.
+       *
+       * @return The file, otherwise an std::unexpected with an error message.
+       */
+      [[nodiscard]] auto acquire_file() -> std::expected<DiskFile, std::string> {
+        auto const prepared = this->prepare_directory();
+        if(not prepared)
+          return std::unexpected(prepared.error());
+        auto const index = *prepared;
+        {
+          auto const lock = std::scoped_lock(this->pool_mutex_);
+          if(auto& pool = this->pools_[index]; not pool.empty()) {
+            auto file = std::move(pool.back());
+            pool.pop_back();
+            this->reused_.fetch_add(1, std::memory_order_relaxed);
+            return file;
+          }
+        }
+        auto file = DiskFile { .path = this->directories_[index] / (common::random_string(32) + ".tmp"), .fd = -1, .allocated = 0, .directory = index };
+        file.fd = ::open(file.path.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+        if(file.fd == -1)
+          return std::unexpected(std::format("failed to create scratch file {}: {}",
+            file.path.generic_string(), std::error_code(errno, std::system_category()).message()));
+        this->created_.fetch_add(1, std::memory_order_relaxed);
+        return file;
+      }
+
+      /**
+       * Takes back a file of the disk tier, keeping it for reuse if the pool has room.
+       *
+       * @param file The file, whose contents are no longer needed.
+       */
+      auto recycle_file(DiskFile file) noexcept -> void {
+        {
+          auto const lock = std::scoped_lock(this->pool_mutex_);
+          if(this->pooled_ < this->pool_files_) {
+            ++this->pooled_;
+            this->pools_[file.directory].push_back(std::move(file));
+            return;
+          }
+        }
+        ::close(file.fd);
+        [[maybe_unused]] auto dummy = std::error_code();
+        std::filesystem::remove(file.path, dummy);
+      }
+
+      /**
+       * Preallocates a file of the disk tier up to a size, in whole extents.
+       *
+       * A file system that cannot preallocate leaves the file to grow as it is written.
+       *
+       * @param file The file.
+       * @param end The size the file is about to reach.
+       */
+      auto preallocate(DiskFile& file, std::size_t end) noexcept -> void {
+        if(end <= file.allocated)
+          return;
+        auto const target = (end + this->extent_bytes_ - 1) / this->extent_bytes_ * this->extent_bytes_;
+        if(::posix_fallocate(file.fd, static_cast<off_t>(file.allocated), static_cast<off_t>(target - file.allocated)) == 0)
+          file.allocated = target;
+      }
+#endif
+
+      /**
+       * Returns how many files of the disk tier were created.
+       *
+       * @return The number of created files.
+       */
+      [[nodiscard]] auto created_files() const noexcept -> std::size_t { return this->created_.load(std::memory_order_relaxed); }
+
+      /**
+       * Returns how many times a pooled file of the disk tier was reused.
+       *
+       * @return The number of reuses.
+       */
+      [[nodiscard]] auto reused_files() const noexcept -> std::size_t { return this->reused_.load(std::memory_order_relaxed); }
+
+      /**
+       * Returns how many files of the disk tier are waiting in the pool.
+       *
+       * @return The number of pooled files.
+       */
+      [[nodiscard]] auto pooled_files() const -> std::size_t {
+        auto const lock = std::scoped_lock(this->pool_mutex_);
+        return this->pooled_;
+      }
+
+      [[nodiscard]] auto directories() const noexcept -> std::span<std::filesystem::path const> { return this->directories_; }
+      [[nodiscard]] auto placement() const noexcept -> ScratchPlacement { return this->placement_; }
+
+      /**
+       * Returns how many files were put in a directory.
+       *
+       * @param index The index of the directory in `directories()`.
+       * @return The number of files placed there so far.
+       */
+      [[nodiscard]] auto placed(std::size_t index) const noexcept -> std::size_t {
+        return this->placed_[index].load(std::memory_order_relaxed);
+      }
+
+    private:
+      struct Tier
+      {
+        std::size_t limit = 0;
+        std::atomic<std::size_t> used = 0;
+        std::atomic<std::size_t> peak = 0;
+      };
+
+      static auto raise_peak(std::atomic<std::size_t>& peak, std::size_t value) noexcept -> void {
+        auto current = peak.load(std::memory_order_relaxed);
+        while(value > current and not peak.compare_exchange_weak(current, value, std::memory_order_relaxed));
+      }
+
+      auto pick_directory() -> std::size_t {
+        auto index = std::size_t(0);
+        if(this->placement_ == ScratchPlacement::FreeSpace) {
+          auto most = std::uintmax_t(0);
+          for(std::size_t i = 0; i < this->directories_.size(); ++i) {
+            auto error = std::error_code();
+            create_directories(this->directories_[i], error);
+            if(auto const info = std::filesystem::space(this->directories_[i], error); not error and info.available > most) {
+              most = info.available;
+              index = i;
+            }
+          }
+        } else
+          index = this->turn_.fetch_add(1, std::memory_order_relaxed) % this->directories_.size();
+        this->placed_[index].fetch_add(1, std::memory_order_relaxed);
+        return index;
+      }
+
+      auto prepare_directory() -> std::expected<std::size_t, std::string> {
+        auto const index = this->pick_directory();
+        auto error = std::error_code();
+        create_directories(this->directories_[index], error);
+        if(error)
+          return std::unexpected(std::format("failed to create scratch directory {}: {}",
+            this->directories_[index].generic_string(), error.message()));
+        return index;
+      }
+
+      std::array<Tier, tier_count> tiers_;
+      std::atomic<std::size_t> spills_ = 0;
+      std::atomic<std::size_t> total_used_ = 0;
+      std::atomic<std::size_t> total_peak_ = 0;
+      std::vector<std::filesystem::path> directories_;
+      std::unique_ptr<std::atomic<std::size_t>[]> placed_;
+      std::atomic<std::size_t> turn_ = 0;
+      ScratchPlacement placement_;
+      mutable std::mutex pool_mutex_;
+      std::vector<std::vector<DiskFile>> pools_;
+      std::size_t pooled_ = 0;
+      std::size_t pool_files_;
+      std::size_t extent_bytes_;
+      std::atomic<std::size_t> created_ = 0;
+      std::atomic<std::size_t> reused_ = 0;
+  };
+
+  /**
+   * A byte file of a temporary run, kept in the fastest tier of a `ScratchSpace`
+   * that has room for it.
+   *
+   * The file is placed on its first write. When a write would make it outgrow its
+   * tier, its contents are moved to the next tier that can hold them, the disk
+   * tier at worst.
+   */
+  class ScratchFile
+  {
+    public:
+      explicit ScratchFile(ScratchSpace& space) noexcept
+        : space_(&space)
+      {}
+
+      ~ScratchFile() noexcept { this->close(); }
+
+      ScratchFile(ScratchFile const&) = delete;
+      ScratchFile& operator=(ScratchFile const&) = delete;
+
+      ScratchFile(ScratchFile&& other) noexcept
+        : space_(std::exchange(other.space_, nullptr))
+        , tier_(other.tier_)
+        , reserved_(std::exchange(other.reserved_, 0))
+        , discarded_(std::exchange(other.discarded_, 0))
+        , size_(std::exchange(other.size_, 0))
+        , memory_(std::move(other.memory_))
+        , fd_(std::exchange(other.fd_, -1))
+        , disk_(std::exchange(other.disk_, {}))
+        , file_(std::move(other.file_))
+      {}
+
+      ScratchFile& operator=(ScratchFile&& other) noexcept {
+        if(this == &other)
+          return *this;
+        this->close();
+        this->space_ = std::exchange(other.space_, nullptr);
+        this->tier_ = other.tier_;
+        this->reserved_ = std::exchange(other.reserved_, 0);
+        this->discarded_ = std::exchange(other.discarded_, 0);
+        this->size_ = std::exchange(other.size_, 0);
+        this->memory_ = std::move(other.memory_);
+        this->fd_ = std::exchange(other.fd_, -1);
+        this->disk_ = std::exchange(other.disk_, {});
+        this->file_ = std::move(other.file_);
+        return *this;
+      }
+
+      /**
+       * Reads bytes at an offset.
+       *
+       * @param bytes The buffer to fill.
+       * @param offset The position of the first byte.
+       * @return The number of bytes read, less than requested at the end of the file.
+       */
+      [[nodiscard]] auto read(std::span<std::byte> bytes, std::size_t offset) -> std::size_t {
+        if(offset >= this->size_)
+          return 0;
+        return this->read_tier(bytes.first(std::min(bytes.size(), this->size_ - offset)), offset);
+      }
+
+      /**
+       * Writes bytes at an offset, moving the file to a slower tier if it outgrows its own.
+       *
+       * @param bytes The bytes to write.
+       * @param offset The position of the first byte.
+       * @return An empty result if the bytes were written, otherwise an std::unexpected with an error message.
+       */
+      [[nodiscard]] auto write(std::span<std::byte const> bytes, std::size_t offset) -> std::expected<void, std::string> {
+        if(bytes.empty())
+          return {};
+        auto const end = offset + bytes.size();
+        if(end > this->reserved_)
+          if(auto const res = this->grow(end); not res)
+            return res;
+        if(not this->write_tier(bytes, offset))
+          return std::unexpected(std::format("failed to write {} bytes to a scratch file in the {} tier: {}",
+            bytes.size(), to_string(this->tier_), std::error_code(errno, std::system_category()).message()));
+        this->size_ = std::max(this->size_, end);
+        return {};
+      }
+
+      /**
+       * Gives back the space of the bytes before an offset, which will not be read again.
+       *
+       * On Linux, once an extent worth of bytes has been read, it is punched out of
+       * a memfd or disk file and its bytes are released from the tier, so a run
+       * frees its space while the rest of it is still being merged. A buffer in
+       * memory is only freed with the whole file.
+       *
+       * @param offset The end of the bytes that are no longer needed.
+       */
+      auto discard_before(std::size_t offset) noexcept -> void {
+#if defined __linux__
+        auto const extent = this->space_->extent_bytes();
+        offset = std::min(offset, this->size_) / discard_alignment * discard_alignment;
+        if(this->tier_ == ScratchTier::Memory or offset < this->discarded_ + extent)
+          return;
+        auto const bytes = offset - this->discarded_;
+        if(::fallocate(this->fd_, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, static_cast<off_t>(this->discarded_), static_cast<off_t>(bytes)) != 0)
+          return;
+        this->space_->release(this->tier_, bytes);
+        this->discarded_ = offset;
+        // the punched extents are gone, a reuse of the file has to preallocate them again
+        this->disk_.allocated = 0;
+#else
+        static_cast<void>(offset);
+#endif
+      }
+
+      /**
+       * Removes the contents of the file and gives back its space; the file can be
+       * written again afterwards.
+       */
+      auto clear() noexcept -> void { this->close(); }
+
+      [[nodiscard]] auto size() const noexcept -> std::size_t { return this->size_; }
+      [[nodiscard]] auto tier() const noexcept -> ScratchTier { return this->tier_; }
+
+      /**
+       * Returns the path of the file on disk.
+       *
+       * @return The path, empty unless the file is in the disk tier.
+       */
+      [[nodiscard]] auto path() const noexcept -> std::filesystem::path const& { return this->disk_.path; }
+
+    private:
+      static constexpr std::size_t copy_chunk_bytes = 64 * 1024;
+
+      /**
+       * The alignment of the ranges punched out of files, a file system block.
+       */
+      static constexpr std::size_t discard_alignment = 4096;
+
+      [[nodiscard]] auto placed() const noexcept -> bool { return this->reserved_ != 0; }
+
+      auto grow(std::size_t end) -> std::expected<void, std::string> {
+        if(this->placed() and this->space_->try_reserve(this->tier_, end - this->reserved_)) {
+          this->reserved_ = end;
+          if(this->tier_ == ScratchTier::Memory)
+            this->memory_.resize(end);
+#if defined __linux__
+          if(this->tier_ == ScratchTier::Disk)
+            this->space_->preallocate(this->disk_, end);
+#endif
+          return {};
+        }
+        auto error = std::format("no scratch tier has room for {} bytes", end);
+        auto const first = this->placed() ? static_cast<std::size_t>(this->tier_) + 1 : 0;
+        for(auto t = first; t < ScratchSpace::tier_count; ++t) {
+          auto const tier = static_cast<ScratchTier>(t);
+          if(not this->space_->try_reserve(tier, end))
+            continue;
+          auto next = ScratchFile(*this->space_);
+          next.tier_ = tier;
+          next.reserved_ = end;
+          if(auto const res = next.open(); not res) {
+            // a slower tier may still take the file
+            error = res.error();
+            continue;
+          }
+          if(not next.copy_from(*this)) {
+            error = std::format("failed to move a scratch file to the {} tier", to_string(tier));
+            continue;
+          }
+          if(this->size_ != 0)
+            this->space_->count_spill();
+          *this = std::move(next);
+          return {};
+        }
+        return std::unexpected(std::move(error));
+      }
+
+      auto open() -> std::expected<void, std::string> {
+        switch(this->tier_) {
+          case ScratchTier::Memory:
+            this->memory_.resize(this->reserved_);
+            return {};
+          case ScratchTier::Memfd:
+#if defined __linux__
+            this->fd_ = ::memfd_create("yuliy_test_task_run", MFD_CLOEXEC);
+            if(this->fd_ == -1)
+              return std::unexpected(std::format("failed to create a memfd scratch file: {}",
+                std::error_code(errno, std::system_category()).message()));
+            return {};
+#else
+            return std::unexpected(std::string("memfd scratch files need Linux"));
+#endif
+          case ScratchTier::Disk:
+            break;
+        }
+#if defined __linux__
+        auto file = this->space_->acquire_file();
+        if(not file)
+          return std::unexpected(file.error());
+        this->disk_ = std::move(*file);
+        this->fd_ = this->disk_.fd;
+        this->space_->preallocate(this->disk_, this->reserved_);
+        return {};
+#else
+        auto const directory = this->space_->next_directory();
+        if(not directory)
+          return std::unexpected(directory.error());
+        this->disk_.path = *directory / (common::random_string(32) + ".tmp");
+        if(not exists(this->disk_.path))
+          auto const stream = std::ofstream(this->disk_.path);
+        // unbuffered: runs are only read and written in blocks that are charged to the memory budget
+        this->file_.rdbuf()->pubsetbuf(nullptr, 0);
+        this->file_.open(this->disk_.path, std::ios::binary | std::ios::out | std::ios::in);
+        if(not this->file_.is_open())
+          return std::unexpected(std::format("failed to create scratch file {}", this->disk_.path.generic_string()));
+        return {};
+#endif
+      }
+
+      auto copy_from(ScratchFile& other) -> bool {
+        auto chunk = std::vector<std::byte>(std::min(copy_chunk_bytes, other.size_));
+        for(std::size_t offset = 0; offset < other.size_;) {
+          auto const n = other.read(chunk, offset);
+          if(n == 0 or not this->write_tier(std::span<std::byte const>(chunk).first(n), offset))
+            return false;
+          offset += n;
+        }
+        this->size_ = other.size_;
+        return true;
+      }
+
+      auto read_tier(std::span<std::byte> bytes, std::size_t offset) -> std::size_t {
+        if(this->tier_ == ScratchTier::Memory) {
+          std::memcpy(bytes.data(), this->memory_.data() + offset, bytes.size());
+          return bytes.size();
+        }
+#if defined __linux__
+        auto done = std::size_t(0);
+        while(done < bytes.size()) {
+          auto const n = ::pread(this->fd_, bytes.data() + done, bytes.size() - done, static_cast<off_t>(offset + done));
+          if(n <= 0)
+            break;
+          done += static_cast<std::size_t>(n);
+        }
+        return done;
+#else
+        this->file_.clear();
+        this->file_.seekg(static_cast<std::streamoff>(offset));
+        this->file_.read(reinterpret_cast<char*>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+        return static_cast<std::size_t>(this->file_.gcount());
+#endif
+      }
+
+      auto write_tier(std::span<std::byte const> bytes, std::size_t offset) -> bool {
+        if(this->tier_ == ScratchTier::Memory) {
+          std::memcpy(this->memory_.data() + offset, bytes.data(), bytes.size());
+          return true;
+        }
+#if defined __linux__
+        for(auto done = std::size_t(0); done < bytes.size();) {
+          auto const n = ::pwrite(this->fd_, bytes.data() + done, bytes.size() - done, static_cast<off_t>(offset + done));
+          if(n <= 0)
+            return false;
+          done += static_cast<std::size_t>(n);
+        }
+        return true;
+#else
+        this->file_.clear();
+        this->file_.seekp(static_cast<std::streamoff>(offset));
+        this->file_.write(reinterpret_cast<char const*>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+        return static_cast<bool>(this->file_);
+#endif
+      }
+
+      auto close() noexcept -> void {
+        if(this->space_ and this->reserved_ != 0)
+          this->space_->release(this->tier_, this->reserved_ - this->discarded_);
+        this->tier_ = ScratchTier::Memory;
+        this->reserved_ = 0;
+        this->discarded_ = 0;
+        this->size_ = 0;
+        this->memory_ = {};
+#if defined __linux__
+        if(this->disk_.fd != -1)
+          this->space_->recycle_file(std::exchange(this->disk_, {}));
+        else if(this->fd_ != -1)
+          ::close(this->fd_);
+#else
+        if(this->file_.is_open())
+          this->file_.close();
+        if(not this->disk_.path.empty()) {
+          [[maybe_unused]] auto dummy = std::error_code();
+          std::filesystem::remove(this->disk_.path, dummy);
+        }
+        this->disk_ = {};
+#endif
+        this->fd_ = -1;
+      }
+
+      ScratchSpace* space_;
+      ScratchTier tier_ = ScratchTier::Memory;
+      std::size_t reserved_ = 0;
+      std::size_t discarded_ = 0;
+      std::size_t size_ = 0;
+      std::vector<std::byte> memory_;
+      int fd_ = -1;                    // the memfd, or the disk file on Linux
+      ScratchSpace::DiskFile disk_;    // the file of the disk tier
+      std::fstream file_;              // the disk file elsewhere
+  };
+} // namespace yuliy_test_task
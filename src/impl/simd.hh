@@ -0,0 +1,281 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <span>
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstring>
+
+#if defined(__SSE2__)
+#  include <immintrin.h>
+#endif
+#if defined(__x86_64__) and (defined(__GNUC__) or defined(__clang__))
+#  include <nmmintrin.h>
+#  define YULIY_TEST_TASK_CRC32C_DISPATCH 1
+#endif
+
+namespace yuliy_test_task::simd
+{
+  /**
+   * Finds the index of the smallest value in a range.
+   *
+   * This is the portable fallback used for element types without a vectorized kernel.
+   *
+   * @param values The values to search, must not be empty.
+   *
+   * @return The index of the first occurrence of the smallest value.
+   */
+  template <typename T>
+  [[nodiscard]] inline auto argmin(std::span<T const> values) -> std::size_t {
+    return static_cast<std::size_t>(std::ranges::min_element(values) - values.begin());
+  }
+
+#if defined(__SSE2__)
+  namespace detail
+  {
+    [[nodiscard]] inline auto min_epi32(__m128i a, __m128i b) -> __m128i {
+#  if defined(__SSE4_1__)
+      return _mm_min_epi32(a, b);
+#  else
+      auto const lt = _mm_cmplt_epi32(a, b);
+      return _mm_or_si128(_mm_and_si128(lt, a), _mm_andnot_si128(lt, b));
+#  endif
+    }
+  } // namespace detail
+
+  /**
+   * Finds the index of the smallest value in a range of 32-bit integers.
+   *
+   * The minimum is reduced four lanes at a time with SIMD compare/blend, then
+   * its first position is located with a vector equality mask.
+   *
+   * @param values The values to search, must not be empty.
+   *
+   * @return The index of the first occurrence of the smallest value.
+   */
+  template <>
+  [[nodiscard]] inline auto argmin<std::int32_t>(std::span<std::int32_t const> values) -> std::size_t {
+    auto const n = values.size();
+    auto const vec_n = n & ~std::size_t(3);
+    if(vec_n == 0)
+      return static_cast<std::size_t>(std::ranges::min_element(values) - values.begin());
+    auto const* data = values.data();
+    auto min_v = _mm_loadu_si128(reinterpret_cast<__m128i const*>(data));
+    for(auto i = std::size_t(4); i < vec_n; i += 4)
+      min_v = detail::min_epi32(min_v, _mm_loadu_si128(reinterpret_cast<__m128i const*>(data + i)));
+    min_v = detail::min_epi32(min_v, _mm_shuffle_epi32(min_v, _MM_SHUFFLE(1, 0, 3, 2)));
+    min_v = detail::min_epi32(min_v, _mm_shuffle_epi32(min_v, _MM_SHUFFLE(2, 3, 0, 1)));
+    auto min = _mm_cvtsi128_si32(min_v);
+    for(auto i = vec_n; i < n; ++i)
+      min = std::min(min, data[i]);
+    auto const needle = _mm_set1_epi32(min);
+    for(auto i = std::size_t(0); i < vec_n; i += 4) {
+      auto const eq = _mm_cmpeq_epi32(needle, _mm_loadu_si128(reinterpret_cast<__m128i const*>(data + i)));
+      auto const mask = static_cast<unsigned>(_mm_movemask_ps(_mm_castsi128_ps(eq)));
+      if(mask != 0)
+        return i + static_cast<std::size_t>(std::countr_zero(mask));
+    }
+    return static_cast<std::size_t>(std::ranges::find(values.subspan(vec_n), min) - values.begin());
+  }
+#endif
+
+  /**
+   * Finds the first value of a range that is greater than the next one.
+   *
+   * This is the portable fallback used for element types without a vectorized kernel.
+   *
+   * @param values The values to check.
+   *
+   * @return The index of the first value greater than its successor, `values.size()` if the range is sorted.
+   */
+  template <typename T>
+  [[nodiscard]] inline auto first_descent(std::span<T const> values) -> std::size_t {
+    auto const end = std::ranges::is_sorted_until(values);
+    return end == values.end() ? values.size() : static_cast<std::size_t>(end - values.begin()) - 1;
+  }
+
+#if defined(__SSE2__)
+  /**
+   * Finds the first value of a range of 32-bit integers that is greater than the next one.
+   *
+   * Four neighbouring pairs are compared at once, with the successors loaded
+   * one element further than the values.
+   *
+   * @param values The values to check.
+   *
+   * @return The index of the first value greater than its successor, `values.size()` if the range is sorted.
+   */
+  template <>
+  [[nodiscard]] inline auto first_descent<std::int32_t>(std::span<std::int32_t const> values) -> std::size_t {
+    auto const n = values.size();
+    auto const* data = values.data();
+    auto i = std::size_t(0);
+    for(; i + 4 < n; i += 4) {
+      auto const gt = _mm_cmpgt_epi32(
+        _mm_loadu_si128(reinterpret_cast<__m128i const*>(data + i)),
+        _mm_loadu_si128(reinterpret_cast<__m128i const*>(data + i + 1)));
+      auto const mask = static_cast<unsigned>(_mm_movemask_ps(_mm_castsi128_ps(gt)));
+      if(mask != 0)
+        return i + static_cast<std::size_t>(std::countr_zero(mask));
+    }
+    for(; i + 1 < n; ++i)
+      if(data[i] > data[i + 1])
+        return i;
+    return n;
+  }
+#endif
+
+  namespace detail
+  {
+    /**
+     * The byte-at-a-time table of the reflected CRC32C (Castagnoli) polynomial.
+     */
+    inline constexpr auto crc32c_table = [] {
+      auto table = std::array<std::uint32_t, 256>();
+      for(auto i = std::uint32_t(0); i < table.size(); ++i) {
+        auto crc = i;
+        for(auto bit = 0; bit < 8; ++bit)
+          crc = (crc >> 1) ^ ((crc & 1) != 0 ? 0x82F63B78u : 0u);
+        table[i] = crc;
+      }
+      return table;
+    }();
+
+    /**
+     * Extends a raw (not inverted) CRC32C state with bytes, one table lookup per byte.
+     */
+    [[nodiscard]] inline auto crc32c_portable(std::span<std::byte const> bytes, std::uint32_t state) noexcept -> std::uint32_t {
+      for(auto const byte : bytes)
+        state = (state >> 8) ^ crc32c_table[(state ^ std::to_integer<std::uint32_t>(byte)) & 0xFF];
+      return state;
+    }
+
+#if defined(YULIY_TEST_TASK_CRC32C_DISPATCH)
+    /**
+     * Extends a raw CRC32C state with bytes, eight at a time with the SSE4.2 `crc32`
+     * instruction. Compiled for SSE4.2 whatever the build targets, so it must only
+     * be called when `has_hardware_crc32c()` is true.
+     */
+    [[nodiscard]] __attribute__((target("sse4.2")))
+    inline auto crc32c_hardware(std::span<std::byte const> bytes, std::uint32_t state) noexcept -> std::uint32_t {
+      auto const* data = bytes.data();
+      auto n = bytes.size();
+      auto state64 = std::uint64_t(state);
+      for(; n >= sizeof(std::uint64_t); n -= sizeof(std::uint64_t), data += sizeof(std::uint64_t)) {
+        auto word = std::uint64_t();
+        std::memcpy(&word, data, sizeof(word));
+        state64 = _mm_crc32_u64(state64, word);
+      }
+      state = static_cast<std::uint32_t>(state64);
+      for(; n > 0; --n, ++data)
+        state = _mm_crc32_u8(state, std::to_integer<std::uint8_t>(*data));
+      return state;
+    }
+#endif
+
+    /**
+     * Checks once whether the CPU has the SSE4.2 `crc32` instruction.
+     */
+    [[nodiscard]] inline auto has_hardware_crc32c() noexcept -> bool {
+#if defined(YULIY_TEST_TASK_CRC32C_DISPATCH)
+      static auto const supported = [] {
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("sse4.2") != 0;
+      }();
+      return supported;
+#else
+      return false;
+#endif
+    }
+  } // namespace detail
+
+  /**
+   * Computes the CRC32C (Castagnoli) checksum of bytes.
+   *
+   * On x86-64 CPUs with SSE4.2 the checksum is computed eight bytes at a time with
+   * the `crc32` instruction, chosen at run time, otherwise with a lookup table.
+   * A checksum can be extended: the checksum of `a` followed by `b` is
+   * `crc32c(b, crc32c(a))`.
+   *
+   * @param bytes The bytes to checksum.
+   * @param crc The checksum of the preceding bytes, 0 for none.
+   *
+   * @return The checksum of the preceding bytes followed by `bytes`.
+   */
+  [[nodiscard]] inline auto crc32c(std::span<std::byte const> bytes, std::uint32_t crc = 0) noexcept -> std::uint32_t {
+#if defined(YULIY_TEST_TASK_CRC32C_DISPATCH)
+    if(detail::has_hardware_crc32c())
+      return ~detail::crc32c_hardware(bytes, ~crc);
+#endif
+    return ~detail::crc32c_portable(bytes, ~crc);
+  }
+} // namespace yuliy_test_task::simd
+
+#if defined UNIT_TESTS
+#include <gtest/gtest.h>
+#include <vector>
+#include <limits>
+#include <string_view>
+
+TEST(Simd, argmin_finds_first_minimum)
+{
+  auto const values = std::vector<std::int32_t> { 7, 3, 9, -4, 12, -4, 0, 5, 1, 8, 6, 2, 11 };
+  ASSERT_EQ(yuliy_test_task::simd::argmin(std::span<std::int32_t const>(values)), 3);
+}
+
+TEST(Simd, argmin_handles_tail_and_extremes)
+{
+  auto values = std::vector<std::int32_t>(7, std::numeric_limits<std::int32_t>::max());
+  values[6] = std::numeric_limits<std::int32_t>::min();
+  ASSERT_EQ(yuliy_test_task::simd::argmin(std::span<std::int32_t const>(values)), 6);
+  values.resize(2);
+  values[1] = 0;
+  ASSERT_EQ(yuliy_test_task::simd::argmin(std::span<std::int32_t const>(values)), 1);
+}
+
+TEST(Simd, first_descent_finds_the_first_unsorted_pair)
+{
+  using namespace yuliy_test_task;
+  auto values = std::vector<std::int32_t>(13);
+  for(std::size_t i = 0; i < values.size(); ++i)
+    values[i] = static_cast<std::int32_t>(i / 2) - 3;
+  ASSERT_EQ(simd::first_descent(std::span<std::int32_t const>(values)), values.size());
+  values[12] = std::numeric_limits<std::int32_t>::min();
+  ASSERT_EQ(simd::first_descent(std::span<std::int32_t const>(values)), 11);
+  values[5] = std::numeric_limits<std::int32_t>::max();
+  ASSERT_EQ(simd::first_descent(std::span<std::int32_t const>(values)), 5);
+  ASSERT_EQ(simd::first_descent(std::span<std::int32_t const>(values).first(1)), 1);
+}
+
+TEST(Simd, crc32c_matches_the_check_value)
+{
+  using namespace yuliy_test_task;
+  auto const text = std::string_view("123456789");
+  auto const bytes = std::as_bytes(std::span(text));
+  ASSERT_EQ(simd::crc32c(bytes), 0xE3069283u);
+  // extending a checksum gives the checksum of the concatenation
+  ASSERT_EQ(simd::crc32c(bytes.subspan(4), simd::crc32c(bytes.first(4))), 0xE3069283u);
+  ASSERT_EQ(~simd::detail::crc32c_portable(bytes, ~std::uint32_t(0)), 0xE3069283u);
+}
+
+TEST(Simd, crc32c_hardware_kernel_matches_the_table)
+{
+  using namespace yuliy_test_task;
+  if(not simd::detail::has_hardware_crc32c())
+    GTEST_SKIP() << "the CPU has no SSE4.2";
+#if defined(YULIY_TEST_TASK_CRC32C_DISPATCH)
+  auto bytes = std::vector<std::byte>(1000);
+  for(std::size_t i = 0; i < bytes.size(); ++i)
+    bytes[i] = static_cast<std::byte>((i * 131 + 7) ^ (i >> 3));
+  // lengths and misalignments around the eight-byte words
+  for(std::size_t offset = 0; offset < 9; ++offset)
+    for(std::size_t length = 0; length + offset <= bytes.size(); length += 37) {
+      auto const part = std::span<std::byte const>(bytes).subspan(offset, length);
+      ASSERT_EQ(simd::detail::crc32c_hardware(part, 0x12345678u), simd::detail::crc32c_portable(part, 0x12345678u))
+        << offset << " " << length;
+    }
+#endif
+}
+#endif
@@ -3,38 +3,63 @@
 #include <utility>
 #include <fstream>
 #include <ranges>
+#include <span>
 #include <queue>
+#include <optional>
+#include <functional>
+#include <limits>
+#include <cstdint>
+#include <stdexcept>
 #include <impl/itape.hh>
 #include <impl/common.hh>
+#include <impl/writer.hh>
+#include <impl/merge.hh>
 
 namespace yuliy_test_task::algorithm
 {
   template <typename T>
   using result_type = std::expected<T, std::string>;
 
+  /**
+   * Thrown when a temporary run reads back a block that does not match the
+   * checksum it was written with, or cannot read back all it holds.
+   */
+  class CorruptRun : public std::runtime_error
+  {
+    public:
+      CorruptRun(std::size_t offset, std::uint32_t expected, std::uint32_t actual)
+        : std::runtime_error(std::format("temporary run is corrupt: block at byte {} has checksum {:08x}, written with {:08x}",
+            offset, actual, expected))
+      {}
+
+      CorruptRun(std::size_t offset, std::size_t size)
+        : std::runtime_error(std::format("temporary run is truncated: reading stopped at byte {} of {}", offset, size))
+      {}
+  };
+
   namespace detail
   {
+    /**
+     * A temporary run of values of type T, kept in the fastest tier of the
+     * scratch space that has room for it.
+     *
+     * A run is written, rewound and read once: the space of the values read is
+     * given back to the scratch space as the reading goes, and the whole file as
+     * soon as the end of the run is reached.
+     *
+     * Every `checksum_block_bytes` bytes of the run are checksummed with CRC32C as
+     * they are written and checked as they are read back, so a corrupted run
+     * throws `CorruptRun` instead of merging wrong values.
+     */
     template <typename T>
     requires (sizeof(T) > 0)
     struct TempFile
     {
-      explicit TempFile(std::vector<T> const& values) {
-        auto const name = common::random_string(32);
-        this->path = std::filesystem::temp_directory_path() / "yuliy_test_task_temp_file_sorter" / name;
-        this->path.replace_extension(".tmp");
-        create_directories(this->path.parent_path());
-        if(not exists(this->path))
-          auto const stream = std::ofstream(this->path);
-        this->stream_ = std::fstream(this->path, std::ios::binary | std::ios::out | std::ios::in);
-        if(not this->stream_)
-          return;
-        this->write(values);
-      }
+      static constexpr inline std::size_t checksum_block_bytes = 64 * 1024;
 
-      ~TempFile() noexcept {
-        [[maybe_unused]] auto dummy = std::error_code();
-        std::filesystem::remove(this->path, dummy);
-      }
+      explicit TempFile(ScratchSpace& space)
+        : file_(space)
+      {}
 
       TempFile(TempFile const&) = delete;
       TempFile& operator=(TempFile const&) = delete;
@@ -43,152 +68,908 @@ namespace yuliy_test_task::algorithm
 
 
       /**
-       * Reads a single value of type T from the temporary file.
+       * Reads up to `values.size()` values of type T from the temporary file.
        *
-       * This function reads a single value of type T from the temporary file
-       * and returns it wrapped in a std::optional. The value is read from the
-       * current position of the file and the position is not changed after the
-       * read operation. The function returns std::nullopt if the file is not
-       * open or if the end of the file has been reached.
+       * The values are read from the current position of the file, which is
+       * advanced past them.
        *
-       * \returns The value read from the file or std::nullopt if there is no
-       * value to read.
+       * \param values The buffer to fill.
+       * \returns The number of values actually read, zero at the end of the file.
        */
-      [[nodiscard]] auto read_one() -> std::optional<T> {
-        if(not this->stream_)
-          return std::nullopt;
-        if(this->stream_.eof())
-          return std::nullopt;
-        auto value = T();
-        this->stream_.read(reinterpret_cast<char*>(&value), sizeof(T));
-        return value;
+      [[nodiscard]] auto read_n(std::span<T> values) -> std::size_t {
+        auto const n = this->file_.read(std::as_writable_bytes(values), this->position_) / sizeof(T);
+        // an empty read before the end would look like the end of the run to a merge cursor
+        if(n == 0 and not values.empty() and this->position_ < this->file_.size())
+          throw CorruptRun(this->position_, this->file_.size());
+        // verified while the block just read is still in cache
+        this->fold(std::as_bytes(values.first(n)), this->read_crc_, [&](std::size_t block, std::uint32_t crc) {
+          if(crc != this->checksums_[block])
+            throw CorruptRun(block * checksum_block_bytes, this->checksums_[block], crc);
+        });
+        this->position_ += n * sizeof(T);
+        if(this->position_ >= this->file_.size()) {
+          if(this->position_ % checksum_block_bytes != 0 and this->read_crc_ != this->write_crc_)
+            throw CorruptRun(this->position_ / checksum_block_bytes * checksum_block_bytes, this->write_crc_, this->read_crc_);
+          this->file_.clear();
+        }
+        else
+          this->file_.discard_before(this->position_);
+        this->stats.reads += n;
+        this->stats.shifts += n;
+        this->stats.bytes += n * sizeof(T);
+        return n;
       }
 
 
       /**
-       * Reads all values of type T from the temporary file.
+       * Writes values of type T to the temporary file.
        *
-       * This function reads all values of type T from the temporary file and
-       * returns them wrapped in a std::vector. The values are read from the
-       * current position of the file and the position is not changed after the
-       * read operation. The function returns an empty std::vector if the file
-       * is not open.
+       * The values are written at the current position of the file, and the
+       * position is moved back to the beginning, ready to read them.
        *
-       * \returns The values read from the file.
+       * \param values The values to write.
+       * \returns An empty result if the values were written, otherwise
+       * an std::unexpected with an error message.
        */
-      [[nodiscard]] auto read() -> std::vector<T> {
-        auto values = std::vector<T>();
-        if(not this->stream_)
-          return values;
-        while(true) {
-          auto const value = this->read_one();
-          if(not value)
-            break;
-          values.push_back(*value);
-        }
-        return values;
+      [[nodiscard]] auto write(std::span<T const> values) -> result_type<void> {
+        if(auto const res = this->file_.write(std::as_bytes(values), this->position_); not res)
+          return std::unexpected(res.error());
+        this->fold(std::as_bytes(values), this->write_crc_, [&](std::size_t, std::uint32_t crc) { this->checksums_.push_back(crc); });
+        this->position_ = 0;
+        this->read_crc_ = 0;
+        this->stats.writes += values.size();
+        this->stats.shifts += values.size();
+        this->stats.bytes += values.size_bytes();
+        ++this->stats.rewinds;
+        return {};
       }
 
 
       /**
-       * Writes values of type T to the temporary file.
+       * Appends values of type T to the temporary file.
        *
-       * This function writes values of type T to the temporary file. The values
-       * are written to the current position of the file and the position is
-       * not changed after the write operation. The function also applies a delay
-       * specified in the config.
+       * This lets a temporary file be the target of a `WriteBehindBuffer` while a
+       * merge pass writes a new run into it. Call `rewind()` before reading the
+       * run back.
        *
-       * \param values The values to write.
+       * \param values The values to append.
+       * \returns An empty result if the values were written, otherwise
+       * an std::unexpected with an error message.
        */
-      auto write(std::vector<T> const& values) -> void {
-        if(not this->stream_)
-          return;
-        this->stream_.write(reinterpret_cast<char const*>(values.data()), values.size() * sizeof(T));
-        this->stream_.flush();
-        this->stream_.seekp(0, std::ios_base::beg);
+      [[nodiscard]] auto write_and_shift_n(std::span<T const> values) -> result_type<void> {
+        if(auto const res = this->file_.write(std::as_bytes(values), this->position_); not res)
+          return std::unexpected(res.error());
+        // with a `WriteBehindBuffer`, this runs on its writer thread, next to the write itself
+        this->fold(std::as_bytes(values), this->write_crc_, [&](std::size_t, std::uint32_t crc) { this->checksums_.push_back(crc); });
+        this->position_ += values.size_bytes();
+        this->stats.writes += values.size();
+        this->stats.shifts += values.size();
+        this->stats.bytes += values.size_bytes();
+        return {};
       }
 
-      std::filesystem::path path;
+
+      /**
+       * Moves the position back to the beginning of the file.
+       */
+      auto rewind() -> void {
+        this->position_ = 0;
+        this->read_crc_ = 0;
+        ++this->stats.rewinds;
+      }
+
+      /**
+       * Returns the tier the run lives in.
+       */
+      [[nodiscard]] auto tier() const noexcept -> ScratchTier { return this->file_.tier(); }
+
+      /**
+       * Returns the path of the run on disk, empty unless it is in the disk tier.
+       */
+      [[nodiscard]] auto path() const noexcept -> std::filesystem::path const& { return this->file_.path(); }
+
+      /**
+       * The operations performed on the temporary file, counted as on a tape.
+       */
+      TapeStats stats;
 
       private:
-        std::fstream stream_;
+        /**
+         * Extends a running block checksum with bytes at the current position,
+         * calling `on_block(index, checksum)` for every block the bytes complete.
+         */
+        template <typename OnBlock>
+        auto fold(std::span<std::byte const> bytes, std::uint32_t& crc, OnBlock&& on_block) const -> void {
+          for(auto offset = this->position_; not bytes.empty();) {
+            auto const room = checksum_block_bytes - offset % checksum_block_bytes;
+            auto const chunk = bytes.first(std::min(room, bytes.size()));
+            crc = simd::crc32c(chunk, crc);
+            offset += chunk.size();
+            bytes = bytes.subspan(chunk.size());
+            if(offset % checksum_block_bytes == 0) {
+              on_block(offset / checksum_block_bytes - 1, crc);
+              crc = 0;
+            }
+          }
+        }
+
+        ScratchFile file_;
+        std::size_t position_ = 0;
+        std::vector<std::uint32_t> checksums_;
+        std::uint32_t write_crc_ = 0;
+        std::uint32_t read_crc_ = 0;
     };
   } // namespace detail
 
 
+  namespace detail
+  {
+    /**
+     * The smallest read buffer the fan-in of a merge is planned for. The buffers
+     * actually given to the cursors are clamped to the RAM limit, see
+     * `cursor_block_elems`.
+     */
+    inline constexpr std::size_t min_cursor_block_elems = 16;
+
+    /**
+     * The smallest RAM limit in elements a merge fits in: two write-behind blocks
+     * and the read buffers of two cursors, one element each.
+     */
+    inline constexpr std::size_t min_merge_elems = 4;
+
+    /**
+     * Calculates the largest number of runs that can be merged at once.
+     *
+     * Half of the RAM limit is given to the merge cursors, the other half to the
+     * write-behind buffer.
+     *
+     * \param max_elems_in_ram The RAM limit in elements.
+     * \returns The largest affordable fan-in, at least 2.
+     */
+    [[nodiscard]] constexpr auto max_fan_in(std::size_t max_elems_in_ram) -> std::size_t {
+      return std::max<std::size_t>(2, max_elems_in_ram / 2 / min_cursor_block_elems);
+    }
+
+    /**
+     * Splits the input tape into sorted runs stored in temporary files.
+     *
+     * \param in The input tape.
+     * \param size The number of elements on the input tape.
+     * \param run_elems The number of elements in every run but the last one.
+     * \param progress If true, the function prints progress information.
+     * \returns The runs, otherwise an std::unexpected with an error message.
+     */
+    template <typename In, typename T = In::value_type>
+    [[nodiscard]] auto make_runs(
+      In& in,
+      std::size_t size,
+      std::size_t run_elems,
+      bool progress
+    ) -> result_type<std::vector<TempFile<T>>> {
+      auto const run_count = (size + run_elems - 1) / run_elems;
+      auto runs = std::vector<TempFile<T>>();
+      runs.reserve(run_count);
+      // one block is read, sorted and written for every run
+      auto block = budget_vector<T>(std::min(run_elems, size), BudgetAllocator<T>(&in.config().budget()));
+      if(progress)
+        common::println("\nReading tape...");
+      for(std::size_t consumed = 0; consumed < size;) {
+        auto const n = in.read_and_shift_n(std::span<T>(block).first(std::min(block.size(), size - consumed)));
+        if(not n)
+          return std::unexpected(n.error());
+        if(*n == 0)
+          break;
+        consumed += *n;
+        auto const data = std::span<T>(block).first(*n);
+        std::sort(data.begin(), data.end());
+        if(auto const res = runs.emplace_back(in.config().scratch()).write(data); not res)
+          return std::unexpected(res.error());
+        if(progress)
+          common::print_progress(runs.size(), run_count);
+      }
+      if(progress)
+        common::println();
+      return runs;
+    }
+
+    /**
+     * Merges sorted runs into a sink.
+     *
+     * \param runs The runs to merge, read from their current position.
+     * \param sink The destination of the merged values.
+     * \param cursor_budget The number of elements shared by the read buffers of the runs.
+     * \param on_emit Called with the number of values after every emitted block.
+     * \param budget The memory budget the read buffers are charged to, if any.
+     */
+    template <typename T, typename Sink, typename OnEmit>
+    auto merge_runs(
+      std::span<TempFile<T>> runs,
+      Sink& sink,
+      std::size_t cursor_budget,
+      OnEmit&& on_emit,
+      MemoryBudget* budget = nullptr
+    ) -> void {
+      auto const block = cursor_block_elems<T>(cursor_budget, runs.size());
+      auto cursors = std::vector<RunCursor<T, TempFile<T>>>();
+      cursors.reserve(runs.size());
+      for(auto& run : runs)
+        cursors.emplace_back(run, block, budget);
+      merge(cursors, sink, on_emit, std::less<>(), budget);
+    }
+
+    /**
+     * Adds the operations performed on temporary runs to a scratch report.
+     */
+    template <typename T>
+    auto collect_stats(std::span<TempFile<T> const> runs, TapeStats* scratch) -> void {
+      if(scratch)
+        for(auto const& run : runs)
+          *scratch += run.stats;
+    }
+
+    /**
+     * Merges runs into the output tape and reports the progress.
+     */
+    template <typename T, typename Out>
+    [[nodiscard]] auto merge_runs_into(
+      std::span<TempFile<T>> runs,
+      Out& out,
+      std::size_t size,
+      std::size_t max_elems_in_ram,
+      bool progress,
+      TapeStats* scratch
+    ) -> result_type<void> {
+      if(progress)
+        common::println("\nSorting...");
+      auto* const budget = &out.config().budget();
+      auto sink = WriteBehindBuffer<T, Out>(out, max_elems_in_ram / 4, budget);
+      auto written = std::size_t(0);
+      merge_runs(runs, sink, max_elems_in_ram / 2, [&](std::size_t n) {
+        written += n;
+        if(progress)
+          common::print_progress(written, size);
+      }, budget);
+      collect_stats<T>(runs, scratch);
+      if(auto const res = sink.finish(); not res)
+        return std::unexpected(res.error());
+      if(progress)
+        common::println();
+      return {};
+    }
+
+    /**
+     * Merges runs `fan_in` at a time into new temporary runs until at most
+     * `fan_in` of them remain.
+     *
+     * \param runs The runs, replaced by the merged ones.
+     * \param fan_in The number of runs merged at once, at least 2.
+     * \param max_elems_in_ram The RAM limit in elements.
+     * \param progress If true, the function prints progress information.
+     * \param scratch If not null, receives the operations performed on the merged runs.
+     * \param space The scratch space the merged runs are kept in.
+     * \param budget The memory budget the merge buffers are charged to, if any.
+     * \returns An empty result if the function was successful, otherwise
+     * an std::unexpected with an error message.
+     */
+    template <typename T>
+    [[nodiscard]] auto merge_down(
+      std::vector<TempFile<T>>& runs,
+      std::size_t fan_in,
+      std::size_t max_elems_in_ram,
+      bool progress,
+      TapeStats* scratch,
+      ScratchSpace& space,
+      MemoryBudget* budget
+    ) -> result_type<void> {
+      for(auto pass = 1; runs.size() > fan_in; ++pass) {
+        if(progress)
+          common::println("\nMerge pass {}: {} runs", pass, runs.size());
+        auto next = std::vector<TempFile<T>>();
+        next.reserve((runs.size() + fan_in - 1) / fan_in);
+        for(std::size_t first = 0; first < runs.size(); first += fan_in) {
+          auto& run = next.emplace_back(space);
+          auto sink = WriteBehindBuffer<T, TempFile<T>>(run, max_elems_in_ram / 4, budget);
+          auto const group = std::span(runs).subspan(first, std::min(fan_in, runs.size() - first));
+          merge_runs(group, sink, max_elems_in_ram / 2, [](std::size_t) {}, budget);
+          if(auto const res = sink.finish(); not res)
+            return std::unexpected(res.error());
+          run.rewind();
+          // the merged runs give their files back for the next group to reuse
+          collect_stats<T>(group, scratch);
+          for(auto& merged : group)
+            merged = TempFile<T>(space);
+          if(progress)
+            common::print_progress(next.size(), next.capacity());
+        }
+        runs = std::move(next);
+      }
+      return {};
+    }
+
+    /**
+     * Sorts the input tape into the output tape with run generation and a merge,
+     * for any pair of tape types. See `sort_into`.
+     */
+    template <typename In, typename Out>
+    [[nodiscard]] auto sort_runs_into(
+      In& in,
+      Out& out,
+      std::size_t fan_in,
+      bool progress,
+      TapeStats* scratch
+    ) -> result_type<void> {
+      using T = In::value_type;
+      auto const max_elems_in_ram = in.config().template ram_limit_elems<T>();
+      auto const size = in.size();
+      if(size == 0)
+        return {};
+      auto runs = make_runs(in, size, max_elems_in_ram, progress);
+      if(not runs)
+        return std::unexpected(runs.error());
+      fan_in = std::min(std::max<std::size_t>(2, fan_in), max_fan_in(max_elems_in_ram));
+      if(auto const res = merge_down(*runs, fan_in, max_elems_in_ram, progress, scratch, in.config().scratch(), &in.config().budget()); not res)
+        return res;
+      return merge_runs_into(std::span(*runs), out, size, max_elems_in_ram, progress, scratch);
+    }
+  } // namespace detail
+
+
   /**
    * Sorts the input tape in ascending order and writes it to the output tape.
    *
    * This function uses a temporary file for sorting and therefore it
    * requires enough free space on the disk. The function also applies a
-   * delay specified in the config.
+   * delay specified in the config. If there are more runs than one merge can
+   * take within the RAM limit, they are merged down in extra passes first.
    *
    * \param in The input tape.
    * \param out The output tape.
    * \param progress If true, the function prints progress information.
+   * \param scratch If not null, receives the operations performed on temporary runs.
    * \returns An empty result if the function was successful, otherwise
    * an std::unexpected with an error message.
    */
   template <typename T>
   [[nodiscard]] auto sort_into(
+    ITape<T>& in,
+    ITape<T>& out,
+    bool progress = false,
+    TapeStats* scratch = nullptr
+  ) -> result_type<void> {
+    return detail::sort_runs_into(in, out, std::numeric_limits<std::size_t>::max(), progress, scratch);
+  }
+
+  /**
+   * Sorts the input tape in ascending order and writes it to the output tape,
+   * calling both tapes through their concrete types.
+   *
+   * Same as the `ITape` overload, but every tape operation on the hot path is
+   * resolved at compile time and can be inlined.
+   *
+   * \param in The input tape.
+   * \param out The output tape.
+   * \param progress If true, the function prints progress information.
+   * \param scratch If not null, receives the operations performed on temporary runs.
+   * \returns An empty result if the function was successful, otherwise
+   * an std::unexpected with an error message.
+   */
+  template <FinalTape In, FinalTape Out>
+  requires std::same_as<typename In::value_type, typename Out::value_type>
+  [[nodiscard]] auto sort_into(
+    In& in,
+    Out& out,
+    bool progress = false,
+    TapeStats* scratch = nullptr
+  ) -> result_type<void> {
+    return detail::sort_runs_into(in, out, std::numeric_limits<std::size_t>::max(), progress, scratch);
+  }
+
+
+  /**
+   * Sorts an input tape that fits in the RAM limit without temporary files.
+   *
+   * \param in The input tape.
+   * \param out The output tape.
+   * \param progress If true, the function prints progress information.
+   * \returns An empty result if the function was successful, otherwise
+   * an std::unexpected with an error message.
+   */
+  template <typename T>
+  [[nodiscard]] auto sort_in_ram_into(
     ITape<T>& in,
     ITape<T>& out,
     bool progress = false
   ) -> result_type<void> {
-    auto const max_elems_in_ram = in.config().template ram_limit_elems<typename ITape<T>::value_type>();
+    auto const size = in.size();
+    if(size > in.config().template ram_limit_elems<typename ITape<T>::value_type>())
+      return std::unexpected(std::format("tape of {} elements does not fit in the ram limit", size));
+    if(progress)
+      common::println("\nSorting in RAM...");
+    auto data = in.read_and_shift_n(size);
+    if(not data)
+      return std::unexpected(data.error());
+    std::sort(data->begin(), data->end());
+    return out.write_and_shift_n(*data);
+  }
+
+
+  /**
+   * Sorts the input tape with a balanced multi-pass merge.
+   *
+   * Runs are merged `fan_in` at a time into new temporary runs until at most
+   * `fan_in` runs remain, which are then merged into the output tape. This keeps
+   * every merge within the RAM limit when there are too many runs for one pass.
+   *
+   * \param in The input tape.
+   * \param out The output tape.
+   * \param fan_in The number of runs merged at once, at least 2.
+   * \param progress If true, the function prints progress information.
+   * \param scratch If not null, receives the operations performed on temporary runs.
+   * \returns An empty result if the function was successful, otherwise
+   * an std::unexpected with an error message.
+   */
+  template <typename T>
+  [[nodiscard]] auto sort_multi_pass_into(
+    ITape<T>& in,
+    ITape<T>& out,
+    std::size_t fan_in,
+    bool progress = false,
+    TapeStats* scratch = nullptr
+  ) -> result_type<void> {
+    return detail::sort_runs_into(in, out, fan_in, progress, scratch);
+  }
+
+
+  namespace detail
+  {
+    /**
+     * Returns the width of the key counters that `sort_counting_into` needs for a tape.
+     *
+     * \param size The number of elements on the tape.
+     * \returns The size of one counter in bytes.
+     */
+    [[nodiscard]] constexpr auto counter_bytes(std::size_t size) -> std::size_t {
+      return size <= std::numeric_limits<std::uint32_t>::max() ? sizeof(std::uint32_t) : sizeof(std::uint64_t);
+    }
+
+    /**
+     * Counts the keys of the input tape and writes them out in order.
+     *
+     * \returns `true` if the tape was sorted, `false` if a key outside the range
+     * was met and nothing was written, otherwise an std::unexpected with an error
+     * message.
+     */
+    template <typename Counter, std::integral T>
+    [[nodiscard]] auto sort_counting_into(
+      ITape<T>& in,
+      ITape<T>& out,
+      T lo,
+      std::size_t range,
+      std::size_t size,
+      bool progress
+    ) -> result_type<bool> {
+      auto const max_elems_in_ram = in.config().template ram_limit_elems<typename ITape<T>::value_type>();
+      auto const chunk = std::max<std::size_t>(1, max_elems_in_ram / 4);
+      auto* const budget = &in.config().budget();
+      auto counts = budget_vector<Counter>(range, BudgetAllocator<Counter>(budget));
+      auto block = budget_vector<T>(std::min(chunk, size), BudgetAllocator<T>(budget));
+
+      if(progress)
+        common::println("\nCounting keys...");
+      for(std::size_t consumed = 0; consumed < size;) {
+        auto const n = in.read_and_shift_n(std::span<T>(block).first(std::min(block.size(), size - consumed)));
+        if(not n)
+          return std::unexpected(n.error());
+        if(*n == 0)
+          break;
+        consumed += *n;
+        for(auto const value : std::span<T const>(block).first(*n)) {
+          auto const key = static_cast<std::int64_t>(value) - static_cast<std::int64_t>(lo);
+          if(key < 0 or static_cast<std::size_t>(key) >= range) {
+            if(progress)
+              common::println("\nKey {} is outside the key range, falling back to external sort", value);
+            return false;
+          }
+          ++counts[static_cast<std::size_t>(key)];
+        }
+        if(progress)
+          common::print_progress(consumed, size);
+      }
+      block = budget_vector<T>(BudgetAllocator<T>(budget));
+
+      auto sink = WriteBehindBuffer<T>(out, max_elems_in_ram / 8, budget);
+      for(std::size_t key = 0; key < range; ++key)
+        for(auto n = counts[key]; n > 0; --n)
+          sink.push(static_cast<T>(static_cast<std::int64_t>(lo) + static_cast<std::int64_t>(key)));
+      if(auto const res = sink.finish(); not res)
+        return std::unexpected(res.error());
+      if(progress)
+        common::println();
+      return true;
+    }
+  } // namespace detail
+
+
+  /**
+   * Sorts the input tape by counting the occurrences of every key.
+   *
+   * The keys must lie in `[lo, hi]`, and the counters for that range must fit in
+   * half of the RAM limit. The input is read once and the output written once,
+   * without temporary files. If a key outside the range is met, the input tape is
+   * rewound and the function falls back to `sort_into`.
+   *
+   * \param in The input tape.
+   * \param out The output tape.
+   * \param lo The smallest possible key.
+   * \param hi The largest possible key.
+   * \param progress If true, the function prints progress information.
+   * \param scratch If not null, receives the operations performed on temporary runs by the fallback.
+   * \returns An empty result if the function was successful, otherwise
+   * an std::unexpected with an error message.
+   */
+  template <std::integral T>
+  [[nodiscard]] auto sort_counting_into(
+    ITape<T>& in,
+    ITape<T>& out,
+    T lo,
+    T hi,
+    bool progress = false,
+    TapeStats* scratch = nullptr
+  ) -> result_type<void> {
     auto const size = in.size();
     if(size == 0)
       return {};
-    auto const tmp_file_count = size / max_elems_in_ram + 1;
-    auto tmp_files = std::vector<detail::TempFile<T>>();
-    tmp_files.reserve(tmp_file_count);
+    if(hi < lo)
+      return std::unexpected(std::format("invalid key range [{}, {}]", lo, hi));
+    auto const range = static_cast<std::size_t>(static_cast<std::int64_t>(hi) - static_cast<std::int64_t>(lo)) + 1;
+    if(range * detail::counter_bytes(size) > in.config().ram_limit_bytes() / 2)
+      return std::unexpected(std::format("counters for {} keys do not fit in the ram limit", range));
+    auto const sorted = detail::counter_bytes(size) == sizeof(std::uint32_t)
+      ? detail::sort_counting_into<std::uint32_t>(in, out, lo, range, size, progress)
+      : detail::sort_counting_into<std::uint64_t>(in, out, lo, range, size, progress);
+    if(not sorted)
+      return std::unexpected(sorted.error());
+    if(*sorted)
+      return {};
+    // the counters are released by now, so the fallback gets the whole RAM limit
+    in.rewind();
+    return sort_into(in, out, progress, scratch);
+  }
 
-    if(progress)
-      common::println("\nReading tape...");
-    auto read = 0;
-    for(std::size_t i = 0; i < tmp_file_count; ++i) {
-      auto data = in.read_and_shift_n(max_elems_in_ram);
-      if(not data)
-        return std::unexpected(data.error());
+
+  namespace detail
+  {
+    /**
+     * Streams a nearly sorted input tape through a sliding min-heap into the output tape.
+     *
+     * \returns `true` if the tape was sorted, `false` if the displacement was
+     * exceeded, otherwise an std::unexpected with an error message.
+     */
+    template <typename T>
+    [[nodiscard]] auto stream_nearly_sorted_into(
+      ITape<T>& in,
+      ITape<T>& out,
+      std::size_t displacement,
+      bool progress
+    ) -> result_type<bool> {
+      auto const max_elems_in_ram = in.config().template ram_limit_elems<typename ITape<T>::value_type>();
+      auto const size = in.size();
+      auto const chunk = std::max<std::size_t>(1, max_elems_in_ram / 4);
+      auto* const budget = &in.config().budget();
+
+      auto heap = budget_vector<T>(BudgetAllocator<T>(budget));
+      heap.reserve(displacement + 1);
+      auto window = std::priority_queue<T, budget_vector<T>, std::greater<T>>(std::greater<T>(), std::move(heap));
+      auto sink = WriteBehindBuffer<T>(out, max_elems_in_ram / 8, budget);
+      auto block = budget_vector<T>(std::min(chunk, size), BudgetAllocator<T>(budget));
+      auto last = std::optional<T>();
+      auto emit = [&] {
+        last = window.top();
+        window.pop();
+        sink.push(*last);
+      };
+
+      if(progress)
+        common::println("\nStreaming nearly sorted tape...");
+      for(std::size_t consumed = 0; consumed < size;) {
+        auto const n = in.read_and_shift_n(std::span<T>(block).first(std::min(block.size(), size - consumed)));
+        if(not n)
+          return std::unexpected(n.error());
+        if(*n == 0)
+          break;
+        consumed += *n;
+        for(auto const value : std::span<T const>(block).first(*n)) {
+          if(last and value < *last) {
+            if(auto const res = sink.finish(); not res)
+              return std::unexpected(res.error());
+            if(progress)
+              common::println("\nDisplacement exceeds {}, falling back to external sort", displacement);
+            return false;
+          }
+          window.push(value);
+          if(window.size() > displacement)
+            emit();
+        }
+        if(progress)
+          common::print_progress(consumed, size);
+      }
+      while(not window.empty())
+        emit();
+      if(auto const res = sink.finish(); not res)
+        return std::unexpected(res.error());
       if(progress)
-        common::print_progress(++read, tmp_file_count);
-      std::sort(data->begin(), data->end());
-      tmp_files.emplace_back(*data);
+        common::println();
+      return true;
     }
-    if(progress)
-      common::println();
-
-    using value_index_type = std::pair<typename ITape<T>::value_type, int>;
-    auto compare = [](
-      value_index_type const& lhs,
-      value_index_type const& rhs
-    ) -> bool { return lhs.first > rhs.first; };
-    auto min_heap = std::priority_queue<
-      value_index_type,
-      std::vector<value_index_type>,
-      decltype(compare)
-    >(compare);
-    for(int i = 0; i < std::ssize(tmp_files); ++i) {
-      auto& tmp_file = tmp_files[i];
-      auto const value = tmp_file.read_one();
-      if(value)
-        min_heap.emplace(*value, i);
+  } // namespace detail
+
+
+  /**
+   * Sorts a nearly sorted input tape in a single streaming pass.
+   *
+   * The input is assumed to have every element at most `displacement` positions
+   * away from its place in the sorted order. Under that assumption a sliding
+   * min-heap of `displacement + 1` elements is enough to emit the output in order
+   * while the input is being read, without any temporary files.
+   *
+   * The assumption is verified on the fly: a value smaller than the last emitted
+   * one proves it wrong, in which case both tapes are rewound and the function
+   * falls back to `sort_into`. It also falls back right away if the window does
+   * not fit in half of the RAM limit.
+   *
+   * \param in The input tape.
+   * \param out The output tape.
+   * \param displacement The largest distance of an element from its sorted position.
+   * \param progress If true, the function prints progress information.
+   * \param scratch If not null, receives the operations performed on temporary runs by the fallback.
+   * \returns An empty result if the function was successful, otherwise
+   * an std::unexpected with an error message.
+   */
+  template <typename T>
+  [[nodiscard]] auto sort_nearly_sorted_into(
+    ITape<T>& in,
+    ITape<T>& out,
+    std::size_t displacement,
+    bool progress = false,
+    TapeStats* scratch = nullptr
+  ) -> result_type<void> {
+    auto const max_elems_in_ram = in.config().template ram_limit_elems<typename ITape<T>::value_type>();
+    if(displacement >= max_elems_in_ram / 2)
+      return sort_into(in, out, progress, scratch);
+    if(in.size() == 0)
+      return {};
+    auto const sorted = detail::stream_nearly_sorted_into(in, out, displacement, progress);
+    if(not sorted)
+      return std::unexpected(sorted.error());
+    if(*sorted)
+      return {};
+    // the window is released by now, so the fallback gets the whole RAM limit
+    auto in_rewound = in.rewind_async();
+    auto out_rewound = out.rewind_async();
+    in_rewound.get();
+    out_rewound.get();
+    return sort_into(in, out, progress, scratch);
+  }
+} // namespace yuliy_test_task::algorithm
+
+#if defined UNIT_TESTS
+#include <gtest/gtest.h>
+#include <impl/tape.hh>
+#include <numeric>
+
+namespace yuliy_test_task::algorithm::testing
+{
+  inline auto sorts_like_reference(char const* input, char const* reference) -> void {
+    auto const config = *Config::from_pwd();
+    auto const path = std::filesystem::temp_directory_path() / std::format("yuliy_test_task_{}.tape", common::random_string(16));
+    static_assert(FinalTape<BinaryTape<int32_t>>);
+    // once through ITape, once through the concrete tape type
+    for(auto const concrete : { false, true }) {
+      {
+        auto const in = *BinaryTape<int32_t>::open(common::canonicalize(input), config);
+        auto const out = *BinaryTape<int32_t>::open(path, config);
+        if(concrete)
+          ASSERT_TRUE(sort_into(*in, *out));
+        else
+          ASSERT_TRUE(sort_into<int32_t>(*in, *out));
+      }
+      auto const out = *BinaryTape<int32_t>::create(path, config);
+      auto const ref = *BinaryTape<int32_t>::create(common::canonicalize(reference), config);
+      ASSERT_EQ(out->size(), ref->size());
+      for(std::size_t i = 0; i < ref->size(); ++i)
+        ASSERT_EQ(out->read_and_shift(), ref->read_and_shift());
+      std::filesystem::remove(path);
     }
-    if(progress)
-      common::println("\nSorting...");
-    auto written = 0;
-    while(not min_heap.empty()) {
-      auto const [val, idx] = min_heap.top();
-      min_heap.pop();
-      out.write_and_shift(val);
-      if(progress)
-        common::print_progress(++written, size);
-      auto new_val = tmp_files[idx].read_one();
-      if(new_val and *new_val)
-        min_heap.emplace(*new_val, idx);
+  }
+} // namespace yuliy_test_task::algorithm::testing
+
+TEST(Sort, nearly_sorted_streaming)
+{
+  using namespace yuliy_test_task;
+  auto const config = *Config::from_pwd();
+  auto const in_path = std::filesystem::temp_directory_path() / std::format("yuliy_test_task_{}.tape", common::random_string(16));
+  auto const out_path = std::filesystem::temp_directory_path() / std::format("yuliy_test_task_{}.tape", common::random_string(16));
+  auto values = std::vector<int32_t>(5000);
+  for(std::size_t i = 0; i < values.size(); ++i)
+    values[i] = static_cast<int32_t>(i / 2);
+  for(std::size_t i = 0; i + 8 <= values.size(); i += 8)
+    std::reverse(values.begin() + i, values.begin() + i + 8);
+  {
+    auto const in = *BinaryTape<int32_t>::create(in_path, config);
+    for(auto const value : values)
+      in->write_and_shift(value);
+  }
+  {
+    auto const in = *BinaryTape<int32_t>::create(in_path, config);
+    auto const out = *BinaryTape<int32_t>::create(out_path, config);
+    ASSERT_TRUE(algorithm::sort_nearly_sorted_into(*in, *out, 8));
+  }
+  std::ranges::sort(values);
+  auto const out = *BinaryTape<int32_t>::create(out_path, config);
+  ASSERT_EQ(out->size(), values.size());
+  for(auto const value : values)
+    ASSERT_EQ(out->read_and_shift(), value);
+  std::filesystem::remove(in_path);
+  std::filesystem::remove(out_path);
+}
+
+TEST(Sort, small_fan_in_merge)
+{
+  yuliy_test_task::algorithm::testing::sorts_like_reference("../tests/test_input1.tape", "../tests/test_output1.tape");
+}
+
+TEST(Sort, heap_merge)
+{
+  yuliy_test_task::algorithm::testing::sorts_like_reference("../tests/test_input2.tape", "../tests/test_output2.tape");
+}
+
+TEST(Sort, runs_fill_fast_scratch_tiers_first)
+{
+  using namespace yuliy_test_task;
+  auto const ini = std::filesystem::temp_directory_path() / std::format("yuliy_test_task_{}.ini", common::random_string(16));
+  std::ofstream(ini) << "ram_limit = 10240\nscratch_ram_limit = 100000\nscratch_memfd_limit = 100000\n";
+  auto const config = *Config::load(ini);
+  std::filesystem::remove(ini);
+  auto const path = std::filesystem::temp_directory_path() / std::format("yuliy_test_task_{}.tape", common::random_string(16));
+  {
+    auto const in = *BinaryTape<int32_t, NoDelay>::open(common::canonicalize("../tests/test_input2.tape"), config);
+    auto const out = *BinaryTape<int32_t, NoDelay>::open(path, config);
+    ASSERT_TRUE(algorithm::sort_multi_pass_into<int32_t>(*in, *out, 4));
+  }
+  auto const& space = config.scratch();
+  ASSERT_GT(space.peak(ScratchTier::Memory), 0);
+  ASSERT_LE(space.peak(ScratchTier::Memory), 100000);
+  ASSERT_GT(space.peak(ScratchTier::Memfd), 0);
+  ASSERT_GT(space.peak(ScratchTier::Disk), 0);
+  // merged runs grow by appends, so some of them outgrow the fast tiers
+  ASSERT_GT(space.spills(), 0);
+  // merged groups hand their files to the runs of the next groups
+  ASSERT_GT(space.reused_files(), 0);
+  ASSERT_LT(space.created_files(), space.placed(0));
+  for(auto const tier : { ScratchTier::Memory, ScratchTier::Memfd, ScratchTier::Disk })
+    ASSERT_EQ(space.used(tier), 0);
+  auto const out = *BinaryTape<int32_t>::create(path, config);
+  auto const ref = *BinaryTape<int32_t>::create(common::canonicalize("../tests/test_output2.tape"), config);
+  ASSERT_EQ(out->size(), ref->size());
+  for(std::size_t i = 0; i < ref->size(); ++i)
+    ASSERT_EQ(out->read_and_shift(), ref->read_and_shift());
+  std::filesystem::remove(path);
+}
+
+TEST(Sort, runs_stripe_across_scratch_directories)
+{
+  using namespace yuliy_test_task;
+  auto const root = std::filesystem::temp_directory_path() / std::format("yuliy_test_task_{}", common::random_string(16));
+  auto const ini = root.string() + ".ini";
+  std::ofstream(ini) << std::format("ram_limit = 10240\nscratch_dirs = {0}/a,{0}/b\nscratch_placement = round_robin\n", root.generic_string());
+  auto const config = *Config::load(ini);
+  std::filesystem::remove(ini);
+  auto const path = root / "out.tape";
+  {
+    auto const in = *BinaryTape<int32_t, NoDelay>::open(common::canonicalize("../tests/test_input2.tape"), config);
+    auto const out = *BinaryTape<int32_t, NoDelay>::open(path, config);
+    ASSERT_TRUE(algorithm::sort_into(*in, *out));
+  }
+  auto const& space = config.scratch();
+  ASSERT_EQ(space.directories().size(), 2);
+  ASSERT_GT(space.placed(0), 0);
+  ASSERT_LE(std::max(space.placed(0), space.placed(1)) - std::min(space.placed(0), space.placed(1)), 1);
+  // only the pooled files are left
+  auto const left = std::distance(std::filesystem::directory_iterator(root / "a"), {})
+    + std::distance(std::filesystem::directory_iterator(root / "b"), {});
+  ASSERT_EQ(left, space.pooled_files());
+  auto const out = *BinaryTape<int32_t>::create(path, config);
+  auto const ref = *BinaryTape<int32_t>::create(common::canonicalize("../tests/test_output2.tape"), config);
+  ASSERT_EQ(out->size(), ref->size());
+  for(std::size_t i = 0; i < ref->size(); ++i)
+    ASSERT_EQ(out->read_and_shift(), ref->read_and_shift());
+  std::filesystem::remove_all(root);
+}
+
+TEST(Sort, consumed_runs_free_scratch_space)
+{
+  using namespace yuliy_test_task;
+  auto const ini = std::filesystem::temp_directory_path() / std::format("yuliy_test_task_{}.ini", common::random_string(16));
+  std::ofstream(ini) << "ram_limit = 10240\nscratch_extent = 4096\n";
+  auto const config = *Config::load(ini);
+  std::filesystem::remove(ini);
+  auto const path = std::filesystem::temp_directory_path() / std::format("yuliy_test_task_{}.tape", common::random_string(16));
+  auto input_bytes = std::size_t(0);
+  {
+    auto const in = *BinaryTape<int32_t, NoDelay>::open(common::canonicalize("../tests/test_input2.tape"), config);
+    auto const out = *BinaryTape<int32_t, NoDelay>::open(path, config);
+    input_bytes = in->size() * sizeof(int32_t);
+    ASSERT_TRUE(algorithm::sort_multi_pass_into<int32_t>(*in, *out, 4));
+  }
+  auto const& space = config.scratch();
+  ASSERT_EQ(space.used(ScratchTier::Disk), 0);
+  // without reclaiming, a merge pass would hold its input runs and a merged group at once
+  auto const run_bytes = config.ram_limit_bytes();
+  ASSERT_LT(space.peak_total(), input_bytes + 4 * run_bytes);
+  std::filesystem::remove(path);
+}
+
+TEST(Sort, corrupt_runs_fail_their_checksum)
+{
+  using namespace yuliy_test_task;
+  using Run = algorithm::detail::TempFile<int32_t>;
+  auto const config = *Config::from_pwd();
+  auto values = std::vector<int32_t>(40000);
+  std::iota(values.begin(), values.end(), 0);
+  auto write = [&](Run& run) {
+    // in chunks that straddle the checksum blocks
+    for(auto rest = std::span<int32_t const>(values); not rest.empty(); rest = rest.subspan(std::min<std::size_t>(rest.size(), 3001)))
+      ASSERT_TRUE(run.write_and_shift_n(rest.first(std::min<std::size_t>(rest.size(), 3001))));
+    run.rewind();
+  };
+  auto read = [](Run& run) {
+    auto result = std::vector<int32_t>();
+    auto buffer = std::vector<int32_t>(2999);
+    for(auto n = run.read_n(buffer); n > 0; n = run.read_n(buffer))
+      result.insert(result.end(), buffer.begin(), buffer.begin() + static_cast<std::ptrdiff_t>(n));
+    return result;
+  };
+  {
+    auto run = Run(config.scratch());
+    write(run);
+    ASSERT_EQ(read(run), values);
+  }
+  // a flipped bit in a full block and in the last, partial one
+  for(auto const offset : { std::size_t(70000), values.size() * sizeof(int32_t) - 1 }) {
+    auto run = Run(config.scratch());
+    write(run);
+    ASSERT_FALSE(run.path().empty());
+    {
+      auto file = std::fstream(run.path(), std::ios::binary | std::ios::in | std::ios::out);
+      file.seekg(static_cast<std::streamoff>(offset));
+      auto const byte = static_cast<char>(file.get() ^ 0x10);
+      file.seekp(static_cast<std::streamoff>(offset));
+      file.put(byte);
     }
-    if(progress)
-      common::println();
-    return {};
+    ASSERT_THROW(std::ignore = read(run), algorithm::CorruptRun);
+  }
+  // a run cut short under the merge
+  auto run = Run(config.scratch());
+  write(run);
+  std::filesystem::resize_file(run.path(), 70000);
+  ASSERT_THROW(std::ignore = read(run), algorithm::CorruptRun);
+}
+
+TEST(Sort, scratch_failures_fail_the_sort)
+{
+  using namespace yuliy_test_task;
+  auto const ini = std::filesystem::temp_directory_path() / std::format("yuliy_test_task_{}.ini", common::random_string(16));
+  std::ofstream(ini) << "ram_limit = 1024\nscratch_dirs = /proc/nonexistent_dir\n";
+  auto const config = *Config::load(ini);
+  std::filesystem::remove(ini);
+  auto const path = std::filesystem::temp_directory_path() / std::format("yuliy_test_task_{}.tape", common::random_string(16));
+  {
+    auto const in = *BinaryTape<int32_t, NoDelay>::open(common::canonicalize("../tests/test_input2.tape"), config);
+    auto const out = *BinaryTape<int32_t, NoDelay>::open(path, config);
+    auto const res = algorithm::sort_into(*in, *out);
+    ASSERT_FALSE(res);
+    ASSERT_TRUE(res.error().contains("/proc/nonexistent_dir")) << res.error();
   }
-} // namespace yuliy_test_task::algorithm
\ No newline at end of file
+  std::filesystem::remove(path);
+}
+#endif
@@ -4,15 +4,25 @@
 #include <vector>
 #include <memory>
 #include <type_traits>
+#include <future>
+#include <optional>
+#include <chrono>
 #include <impl/itape.hh>
 #include <impl/config.hh>
 #include <impl/common.hh>
 #include <impl/io.hh>
+#include <impl/delay.hh>
 
 namespace yuliy_test_task
 {
-  template <TapeElement T, TapeIO<T> Io>
-  class Tape : public ITape<T>
+  /**
+   * A tape emulated on top of a backend.
+   *
+   * @tparam Io The backend that stores the values.
+   * @tparam Delay How the configured delays are paid, see `delay.hh`.
+   */
+  template <TapeElement T, TapeIO<T> Io, DelayPolicy Delay = RealDelay>
+  class Tape final : public ITape<T>
   {
    public:
     /**
@@ -27,10 +37,33 @@ namespace yuliy_test_task
       std::filesystem::path filename,
       Config const& config
     ) -> ITape<T>::template result_type<std::unique_ptr<ITape<T>>> {
-      return std::unique_ptr<ITape<T>>(new Tape<T, Io>(std::move(filename), config));
+      return std::unique_ptr<ITape<T>>(new Tape(std::move(filename), config));
     }
 
-    ~Tape() override = default;
+    /**
+     * Creates a new instance of the Tape class that keeps its concrete type.
+     *
+     * Algorithms that take the tape by its concrete type call it without virtual
+     * dispatch.
+     *
+     * @param filename The path to the file used by the Tape.
+     * @param config   The configuration for the Tape.
+     *
+     * @return A unique pointer to the newly created Tape instance.
+     */
+    [[nodiscard]] static auto open(
+      std::filesystem::path filename,
+      Config const& config
+    ) -> ITape<T>::template result_type<std::unique_ptr<Tape>> {
+      return std::unique_ptr<Tape>(new Tape(std::move(filename), config));
+    }
+
+    /**
+     * Charges the write of the block under the head, if it is still pending.
+     */
+    ~Tape() override {
+      this->flush_block();
+    }
 
     /**
      * Reads a single value from the tape.
@@ -38,7 +71,12 @@ namespace yuliy_test_task
      * @return The read value.
      */
     [[nodiscard]] auto read() const -> T override {
-      common::delay(this->config().read_delay());
+      if(this->block_elems_ == 1) {
+        ++this->stats_.reads;
+        if(not this->config().streaming())
+          this->delay_(this->config().read_delay());
+      } else
+        this->touch_blocks(1, false);
       return this->io_.read();
     }
 
@@ -58,39 +96,66 @@ namespace yuliy_test_task
      *
      * @param n The number of values to read and shift.
      *
-     * @return The read values.
+     * @return The read values, fewer than n at the end of the tape.
      *
      * @throws std::runtime_error if the number of values to read exceeds the RAM limit.
      */
     [[nodiscard]] auto read_and_shift_n(std::size_t n)
-      -> ITape<T>::template result_type<std::vector<T>> override {
+      -> ITape<T>::template result_type<budget_vector<T>> override {
+      auto values = budget_vector<T>(BudgetAllocator<T>(&this->config().budget()));
       if(n == 0)
-        return std::vector<T>();
+        return values;
       if(n > this->config().template ram_limit_elems<T>())
         return std::unexpected(std::format("ram limit exceeded on read: {} bytes, requested {} bytes",
           this->config().ram_limit_bytes(),
           this->config().template ram_limit_elems<T>()
         ));
-      auto values = std::vector<T>();
-      for(auto i = 0; i < n; ++i) {
-        if(this->eof())
-          break;
-        values.push_back(this->read_and_shift());
-      }
-      if(not values.back())
-        values.pop_back();
+      values.resize(n);
+      auto const read = this->read_and_shift_n(std::span<T>(values));
+      if(not read)
+        return std::unexpected(read.error());
+      values.resize(*read);
       return values;
     }
 
+    /**
+     * Reads and shifts values from the tape into a caller's buffer.
+     *
+     * The values are transferred with a single bulk read from the backend, and the
+     * read and shift delays for all of them, or for every block they span, are
+     * charged at once.
+     *
+     * @param values The buffer to fill.
+     *
+     * @return The number of values read, fewer than the size of the buffer at the end of the tape.
+     */
+    [[nodiscard]] auto read_and_shift_n(std::span<T> values)
+      -> ITape<T>::template result_type<std::size_t> override {
+      if(values.empty() or this->eof())
+        return 0;
+      if(values.size() > this->config().template ram_limit_elems<T>())
+        return std::unexpected(std::format("ram limit exceeded on read: {} bytes, requested {} bytes",
+          this->config().ram_limit_bytes(),
+          values.size_bytes()
+        ));
+      auto const n = this->io_.read_n(values);
+      this->touch_blocks(n, false);
+      this->charge_transfer(n, ITape<T>::Direction::Right, &TapeStats::reads, this->config().read_delay());
+      return n;
+    }
+
     /**
      * Shifts the tape in the specified direction.
      *
+     * With blocks, a shift is not charged by itself: the blocks are charged when
+     * values are transferred in them, see `touch_blocks`.
+     *
      * @param direction The direction to shift the tape.
      *
      * @return `true` if the shift was successful, `false` otherwise.
      */
     [[nodiscard]] auto shift(ITape<T>::Direction direction) -> bool override {
-      common::delay(this->config().tape_shift_delay());
+      this->charge_transfer(1, direction, nullptr, std::chrono::microseconds());
       return this->io_.shift(direction);
     }
 
@@ -100,7 +165,12 @@ namespace yuliy_test_task
      * @param value The value to write.
      */
     auto write(T value) -> void override {
-      common::delay(this->config().write_delay());
+      if(this->block_elems_ == 1) {
+        ++this->stats_.writes;
+        if(not this->config().streaming())
+          this->delay_(this->config().write_delay());
+      } else
+        this->touch_blocks(1, true);
       this->io_.write(value);
     }
 
@@ -119,26 +189,30 @@ namespace yuliy_test_task
     /**
      * Writes and shifts n values from the tape.
      *
-     * @param values The values to write and shift.
+     * The values are transferred with a single bulk write to the backend, and the
+     * write and shift delays for the whole block are charged at once.
      *
-     *         write exceeds the RAM limit.
+     * @param values The values to write and shift.
      *
-     * @throws std::runtime_error if the number of values to write exceeds the RAM limit.
+     * @return An empty result if every value was written, otherwise an
+     * std::unexpected with an error message: the values exceed the RAM limit, the
+     * tape is at its end or the backend failed to write them.
      */
-    [[nodiscard]] auto write_and_shift_n(std::vector<T> const& values)
+    [[nodiscard]] auto write_and_shift_n(std::span<T const> values)
       -> ITape<T>::template result_type<void> override {
       if(values.empty())
         return {};
       if(values.size() > this->config().template ram_limit_elems<T>())
         return std::unexpected(std::format("ram limit exceeded on write: {} bytes, requested {} bytes",
           this->config().ram_limit_bytes(),
-          this->config().template ram_limit_elems<T>()
+          values.size_bytes()
         ));
-      for(auto const& value : values) {
-        if(this->eof())
-          break;
-        this->write_and_shift(value);
-      }
+      if(this->eof())
+        return std::unexpected(std::format("failed to write tape {}: the tape is at its end", this->filename().generic_string()));
+      this->touch_blocks(values.size(), true);
+      this->charge_transfer(values.size(), ITape<T>::Direction::Right, &TapeStats::writes, this->config().write_delay());
+      if(not this->io_.write_n(values))
+        return std::unexpected(std::format("failed to write {} values to tape {}", values.size(), this->filename().generic_string()));
       return {};
     }
 
@@ -148,10 +222,35 @@ namespace yuliy_test_task
      * @note This function is blocking and will delay the execution of the program by the configured tape rewind delay.
      */
     auto rewind() -> void override {
-      common::delay(this->config().tape_rewind_delay());
+      this->flush_block();
+      this->block_.reset();
+      ++this->stats_.rewinds;
+      this->delay_(this->config().tape_rewind_delay());
+      this->direction_.reset();
+      this->head_ = 0;
       this->io_.rewind();
     }
 
+    /**
+     * Starts rewinding the tape to its beginning on a drive thread of its own.
+     *
+     * The rewind delay is paid on that thread, so the caller can keep working on
+     * other tapes meanwhile.
+     *
+     * @return A future that becomes ready when the tape is at its beginning.
+     */
+    [[nodiscard]] auto rewind_async() -> std::future<void> override {
+      this->flush_block();
+      this->block_.reset();
+      ++this->stats_.rewinds;
+      return std::async(std::launch::async, [this] {
+        this->delay_(this->config().tape_rewind_delay());
+        this->direction_.reset();
+        this->head_ = 0;
+        this->io_.rewind();
+      });
+    }
+
     /**
      * Checks if the tape has reached its end.
      *
@@ -197,21 +296,211 @@ namespace yuliy_test_task
       return this->config_;
     }
 
+    /**
+     * Returns the operations performed on the tape so far.
+     *
+     * @return The operation counters of the tape.
+     */
+    [[nodiscard]] auto stats() const -> TapeStats const& override {
+      return this->stats_;
+    }
+
    private:
+    /**
+     * Moves the head over n values and returns the number of units to charge.
+     *
+     * A unit is a value. With blocks the moves are free, as the blocks are charged
+     * by `touch_blocks`, but turning the tape around leaves the block under the
+     * head, so its pending write is charged.
+     *
+     * @param n The number of values.
+     * @param direction The direction the tape moves in.
+     *
+     * @return The number of units.
+     */
+    auto advance(std::size_t n, ITape<T>::Direction direction) -> std::size_t {
+      auto const before = this->head_;
+      this->head_ = direction == ITape<T>::Direction::Right ? before + n : before - std::min(before, n);
+      if(this->block_elems_ == 1)
+        return n;
+      if(this->heading_ and *this->heading_ != direction)
+        this->flush_block();
+      this->heading_ = direction;
+      return 0;
+    }
+
+    /**
+     * Charges n block operations, each with a shift.
+     */
+    auto charge_blocks(std::size_t n, std::size_t TapeStats::* op, std::chrono::microseconds op_delay) const -> void {
+      if(n == 0)
+        return;
+      this->stats_.shifts += n;
+      this->stats_.*op += n;
+      if(not this->config().streaming())
+        this->delay_((this->config().tape_shift_delay() + op_delay) * static_cast<std::chrono::microseconds::rep>(n));
+    }
+
+    /**
+     * Charges the pending write of the block under the head. The block stays
+     * buffered, so reading it back is free.
+     */
+    auto flush_block() const -> void {
+      if(not this->block_dirty_)
+        return;
+      this->charge_blocks(1, &TapeStats::writes, this->config().write_delay());
+      this->block_dirty_ = false;
+      this->block_read_ = true;
+    }
+
+    /**
+     * Charges the blocks of the n values from the head on that are read or written.
+     *
+     * A block is read when a value in it is first read after the head entered it,
+     * unless it was written meanwhile. A written block is charged once when the
+     * head leaves it: when a transfer moves into another block, when the tape turns
+     * around, rewinds or is closed. Blocks a transfer passes over completely are
+     * charged right away.
+     *
+     * @param n The number of values, transferred to the right.
+     * @param write Whether the values are written rather than read.
+     */
+    auto touch_blocks(std::size_t n, bool write) const -> void {
+      if(this->block_elems_ == 1 or n == 0)
+        return;
+      auto const visit = [&] {
+        if(write)
+          this->block_dirty_ = true;
+        else if(not this->block_read_ and not this->block_dirty_) {
+          this->charge_blocks(1, &TapeStats::reads, this->config().read_delay());
+          this->block_read_ = true;
+        }
+      };
+      auto const enter = [&](std::size_t block) {
+        this->flush_block();
+        this->block_ = block;
+        this->block_read_ = false;
+      };
+      auto const first = this->head_ / this->block_elems_;
+      auto const last = (this->head_ + n - 1) / this->block_elems_;
+      if(this->block_ != first)
+        enter(first);
+      visit();
+      if(last == first)
+        return;
+      if(write)
+        this->charge_blocks(last - first - 1, &TapeStats::writes, this->config().write_delay());
+      else
+        this->charge_blocks(last - first - 1, &TapeStats::reads, this->config().read_delay());
+      enter(last);
+      visit();
+    }
+
+    /**
+     * Charges the delay of moving the tape over n values.
+     *
+     * Under the flat model every unit, see `advance`, costs the shift delay plus
+     * `op_delay`, and is counted as a shift and as the operation `op`. Under the
+     * streaming model the values cost their transfer time at the streaming rate,
+     * plus the locate delay if the tape changes direction, or the start/stop
+     * penalty if the drive was stopped: after a rewind, or when the previous
+     * transfer ended more than the streaming window ago.
+     *
+     * @param n The number of values.
+     * @param direction The direction the tape moves in.
+     * @param op The counter of the operation done on every unit, if any.
+     * @param op_delay The flat delay of that operation.
+     */
+    auto charge_transfer(
+      std::size_t n,
+      ITape<T>::Direction direction,
+      std::size_t TapeStats::* op,
+      std::chrono::microseconds op_delay
+    ) -> void {
+      auto const units = this->advance(n, direction);
+      this->stats_.shifts += units;
+      if(op)
+        this->stats_.*op += units;
+      this->stats_.bytes += n * sizeof(T);
+      auto const& model = this->config().streaming();
+      if(not model) {
+        this->delay_((this->config().tape_shift_delay() + op_delay) * static_cast<std::chrono::microseconds::rep>(units));
+        return;
+      }
+      auto cost = std::chrono::nanoseconds(static_cast<std::chrono::nanoseconds::rep>(n * sizeof(T) * 1000 / model->bytes_per_us));
+      if(this->direction_ and *this->direction_ != direction) {
+        ++this->stats_.reversals;
+        cost += model->locate_delay;
+      } else if(not this->direction_ or std::chrono::steady_clock::now() - this->last_transfer_ > model->window) {
+        ++this->stats_.stalls;
+        cost += model->start_stop_penalty;
+      }
+      this->delay_(cost);
+      this->direction_ = direction;
+      this->last_transfer_ = std::chrono::steady_clock::now();
+    }
+
     Tape(
       std::filesystem::path filename,
       Config const& config
     ) noexcept(false)
       : config_(config)
-      , io_(std::move(filename))
+      , io_(make_io(std::move(filename), config))
+      , block_elems_(std::max<std::size_t>(1, config.block_size() / sizeof(T)))
     {}
 
+    /**
+     * Creates the backend, handing it the block size if it can buffer blocks.
+     */
+    [[nodiscard]] static auto make_io(std::filesystem::path filename, Config const& config) -> Io {
+      if constexpr(std::constructible_from<Io, std::filesystem::path, std::size_t>)
+        return Io(std::move(filename), std::max<std::size_t>(1, config.block_size() / sizeof(T)));
+      else
+        return Io(std::move(filename));
+    }
+
     Config const& config_;
     mutable Io io_;
+    [[no_unique_address]] Delay delay_;
+    std::size_t block_elems_;
+    std::size_t head_ = 0;
+    /// the block under the head since a transfer entered it, with blocks
+    mutable std::optional<std::size_t> block_;
+    /// whether that block was read, or written and not yet charged
+    mutable bool block_read_ = false;
+    mutable bool block_dirty_ = false;
+    std::optional<typename ITape<T>::Direction> heading_;
+    std::optional<typename ITape<T>::Direction> direction_;
+    std::chrono::steady_clock::time_point last_transfer_;
+    mutable TapeStats stats_;
   };
 
+  template <typename T, typename Delay = RealDelay>
+  using BinaryTape = Tape<T, BinaryFileIO<T>, Delay>;
+
+  /**
+   * Creates a binary tape that pays its delays the way the configuration asks.
+   *
+   * @param filename The path to the file used by the tape.
+   * @param config   The configuration for the tape.
+   *
+   * @return A unique pointer to the newly created tape.
+   */
   template <typename T>
-  using BinaryTape = Tape<T, BinaryFileIO<T>>;
+  [[nodiscard]] auto create_binary_tape(
+    std::filesystem::path filename,
+    Config const& config
+  ) -> ITape<T>::template result_type<std::unique_ptr<ITape<T>>> {
+    switch(config.delay_mode()) {
+      case DelayMode::Virtual:
+        return BinaryTape<T, VirtualDelay>::create(std::move(filename), config);
+      case DelayMode::None:
+        return BinaryTape<T, NoDelay>::create(std::move(filename), config);
+      case DelayMode::Real:
+        break;
+    }
+    return BinaryTape<T>::create(std::move(filename), config);
+  }
 } // namespace yuliy_test_task
 
 
@@ -219,6 +508,8 @@ namespace yuliy_test_task
 #include <gtest/gtest.h>
 #include <chrono>
 #include <format>
+#include <array>
+#include <impl/writer.hh>
 
 TEST(Tape, check_config)
 {
@@ -310,4 +601,190 @@ TEST(Tape, check_is_sorted)
   ASSERT_EQ(tape3->size(), tape3->size());
 }
 
-#endif
\ No newline at end of file
+TEST(Tape, failed_writes_are_reported)
+{
+  using namespace yuliy_test_task;
+  auto const config = *Config::from_pwd();
+  auto const path = std::filesystem::temp_directory_path() / std::format("yuliy_test_task_{}.tape", common::random_string(16));
+  {
+    auto const tape = *BinaryTape<int32_t, NoDelay>::open(path, config);
+    auto const values = std::array<int32_t, 4> { 1, 2, 3, 4 };
+    ASSERT_TRUE(tape->write_and_shift_n(values));
+    tape->rewind();
+    // reading past the end leaves the tape at its end, where nothing can be written
+    auto buffer = std::array<int32_t, 8>();
+    ASSERT_EQ(*tape->read_and_shift_n(std::span(buffer)), 4);
+    ASSERT_TRUE(tape->eof());
+    auto const res = tape->write_and_shift_n(values);
+    ASSERT_FALSE(res);
+    ASSERT_TRUE(res.error().contains("at its end"));
+    auto sink = WriteBehindBuffer<int32_t>(*tape, 2);
+    sink.push(std::span<int32_t const>(values));
+    ASSERT_FALSE(sink.finish());
+  }
+  std::filesystem::remove(path);
+}
+
+TEST(Tape, virtual_delay_advances_clock)
+{
+  using namespace yuliy_test_task;
+  auto const config = *Config::from_pwd();
+  const auto tape = *BinaryTape<int32_t, VirtualDelay>::open(common::canonicalize("../tests/test_input1.tape"), config);
+  auto values = std::array<int32_t, 4>();
+  auto const before = VirtualDelay::now();
+  ASSERT_EQ(*tape->read_and_shift_n(std::span(values)), values.size());
+  tape->rewind();
+  ASSERT_EQ(VirtualDelay::now() - before,
+    (config.read_delay() + config.tape_shift_delay()) * 4 + config.tape_rewind_delay());
+  ASSERT_EQ(values[0], 892);
+  static_assert(sizeof(BinaryTape<int32_t, NoDelay>) == sizeof(BinaryTape<int32_t>));
+}
+
+TEST(Tape, streaming_model_charges_stalls_and_reversals)
+{
+  using namespace yuliy_test_task;
+  auto const path = std::filesystem::temp_directory_path() / std::format("yuliy_test_task_{}.ini", common::random_string(16));
+  {
+    auto ini = std::ofstream(path);
+    ini << "ram_limit = 10240\nstream_rate = 4\nstream_window = 1000000000\nstart_stop_penalty = 500\nlocate_delay = 50\n";
+  }
+  auto const config = *Config::load(path);
+  std::filesystem::remove(path);
+  ASSERT_TRUE(config.streaming());
+  const auto tape = *BinaryTape<int32_t, VirtualDelay>::open(common::canonicalize("../tests/test_input2.tape"), config);
+  auto values = std::array<int32_t, 100>();
+  auto const before = VirtualDelay::now();
+  ASSERT_EQ(*tape->read_and_shift_n(std::span(values)), values.size());
+  ASSERT_EQ(*tape->read_and_shift_n(std::span(values)), values.size());
+  // the drive starts once, then streams 800 bytes at 4 bytes per microsecond
+  ASSERT_EQ(VirtualDelay::now() - before, 500us + 200us);
+  ASSERT_TRUE(tape->shift(ITape<int32_t>::Direction::Left));
+  ASSERT_EQ(VirtualDelay::now() - before, 500us + 200us + 50us + 1us);
+  ASSERT_EQ(tape->stats().stalls, 1);
+  ASSERT_EQ(tape->stats().reversals, 1);
+  ASSERT_EQ(tape->stats().modeled_time(config), 500us + 200us + 50us + 1us);
+}
+
+TEST(Tape, blocks_amortize_delays)
+{
+  using namespace yuliy_test_task;
+  auto const path = std::filesystem::temp_directory_path() / std::format("yuliy_test_task_{}.ini", common::random_string(16));
+  {
+    auto ini = std::ofstream(path);
+    ini << "ram_limit = 10240\nread_delay = 3\ntape_shift_delay = 1\nblock_size = 64\n";
+  }
+  auto const config = *Config::load(path);
+  std::filesystem::remove(path);
+  const auto tape = *BinaryTape<int32_t, VirtualDelay>::open(common::canonicalize("../tests/test_input2.tape"), config);
+  auto values = std::array<int32_t, 100>();
+  auto const before = VirtualDelay::now();
+  ASSERT_EQ(*tape->read_and_shift_n(std::span(values)), values.size());
+  // 100 values of 16 per block span 7 blocks, the first one included
+  ASSERT_EQ(tape->stats().reads, 7);
+  ASSERT_EQ(tape->stats().shifts, 7);
+  ASSERT_EQ(VirtualDelay::now() - before, 7 * 4us);
+  // reading back from the buffered block, crossing into the previous one once
+  for(auto i = values.size(); i-- > 90;) {
+    ASSERT_TRUE(tape->shift(ITape<int32_t>::Direction::Left));
+    ASSERT_EQ(tape->read(), values[i]);
+  }
+  ASSERT_EQ(tape->stats().reads, 8);
+  ASSERT_EQ(VirtualDelay::now() - before, 8 * 4us);
+}
+
+TEST(Tape, blocks_charge_writes_to_writes)
+{
+  using namespace yuliy_test_task;
+  auto const ini = std::filesystem::temp_directory_path() / std::format("yuliy_test_task_{}.ini", common::random_string(16));
+  std::ofstream(ini) << "ram_limit = 10240\nread_delay = 3\nwrite_delay = 5\ntape_shift_delay = 1\nblock_size = 64\n";
+  auto const config = *Config::load(ini);
+  std::filesystem::remove(ini);
+  auto const path = std::filesystem::temp_directory_path() / std::format("yuliy_test_task_{}.tape", common::random_string(16));
+  {
+    const auto tape = *BinaryTape<int32_t, VirtualDelay>::open(path, config);
+    auto const before = VirtualDelay::now();
+    // 40 values of 16 per block span 3 blocks, the last one is written when the head leaves it
+    for(auto i = 0; i < 40; ++i)
+      tape->write_and_shift(i);
+    ASSERT_EQ(tape->stats().writes, 2);
+    ASSERT_EQ(tape->stats().reads, 0);
+    ASSERT_EQ(VirtualDelay::now() - before, 2 * 6us);
+    // turning around writes it, then reading back over the boundary of the last two blocks is a read
+    for(auto i = 40; i-- > 30;) {
+      ASSERT_TRUE(tape->shift(ITape<int32_t>::Direction::Left));
+      ASSERT_EQ(tape->read(), i);
+    }
+    ASSERT_EQ(tape->stats().writes, 3);
+    ASSERT_EQ(tape->stats().reads, 1);
+    ASSERT_EQ(VirtualDelay::now() - before, 3 * 6us + 4us);
+  }
+  std::filesystem::remove(path);
+}
+
+TEST(Tape, blocks_charge_transfers_within_one_block)
+{
+  using namespace yuliy_test_task;
+  auto const ini = std::filesystem::temp_directory_path() / std::format("yuliy_test_task_{}.ini", common::random_string(16));
+  std::ofstream(ini) << "ram_limit = 10240\nread_delay = 3\nwrite_delay = 5\ntape_shift_delay = 1\ntape_rewind_delay = 0\nblock_size = 64\n";
+  auto const config = *Config::load(ini);
+  std::filesystem::remove(ini);
+  auto values = std::array<int32_t, 4>();
+  {
+    // the block under the head at the start is read by the first transfer
+    const auto tape = *BinaryTape<int32_t, VirtualDelay>::open(common::canonicalize("../tests/test_input2.tape"), config);
+    auto const before = VirtualDelay::now();
+    ASSERT_EQ(*tape->read_and_shift_n(std::span(values)), values.size());
+    auto const head = tape->read();
+    ASSERT_EQ((*tape->read_and_shift_n(1))[0], head);
+    ASSERT_EQ(tape->stats().reads, 1);
+    ASSERT_EQ(VirtualDelay::now() - before, 4us);
+  }
+  auto const path = std::filesystem::temp_directory_path() / std::format("yuliy_test_task_{}.tape", common::random_string(16));
+  {
+    // a partial block is written on rewind
+    auto tape = *BinaryTape<int32_t, VirtualDelay>::open(path, config);
+    ASSERT_TRUE(tape->write_and_shift_n(values));
+    ASSERT_EQ(tape->stats().writes, 0);
+    tape->rewind();
+    ASSERT_EQ(tape->stats().writes, 1);
+    // and when the tape is closed
+    ASSERT_TRUE(tape->write_and_shift_n(values));
+    auto const before = VirtualDelay::now();
+    tape.reset();
+    ASSERT_EQ(VirtualDelay::now() - before, 6us);
+  }
+  std::filesystem::remove(path);
+}
+
+TEST(Tape, rewinds_overlap_on_independent_drives)
+{
+  using namespace yuliy_test_task;
+  auto const config = *Config::from_pwd();
+  const auto first = *BinaryTape<int32_t>::open(common::canonicalize("../tests/test_input1.tape"), config);
+  const auto second = *BinaryTape<int32_t>::open(common::canonicalize("../tests/test_input2.tape"), config);
+  auto const head = *first->read_and_shift_n(4);
+  std::ignore = *second->read_and_shift_n(4);
+  auto first_rewound = first->rewind_async();
+  auto second_rewound = second->rewind_async();
+  first_rewound.get();
+  second_rewound.get();
+  ASSERT_EQ(first->stats().rewinds, 1);
+  ASSERT_EQ(second->stats().rewinds, 1);
+  ASSERT_EQ(*first->read_and_shift_n(4), head);
+}
+
+TEST(Tape, read_charges_memory_budget)
+{
+  auto const config = *yuliy_test_task::Config::from_pwd();
+  auto const m = config.ram_limit_elems<int32_t>();
+  const auto tape = *yuliy_test_task::BinaryTape<int32_t>::create(yuliy_test_task::common::canonicalize("../tests/test_input2.tape"), config);
+  {
+    const auto data = *tape->read_and_shift_n(m);
+    ASSERT_EQ(config.budget().used(), m * sizeof(int32_t));
+    ASSERT_THROW(std::ignore = tape->read_and_shift_n(1), yuliy_test_task::BudgetExceeded);
+  }
+  ASSERT_EQ(config.budget().used(), 0);
+  ASSERT_EQ(config.budget().peak(), config.budget().limit());
+}
+
+#endif
@@ -0,0 +1,223 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <expected>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <optional>
+#include <span>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <impl/simd.hh>
+#if defined __linux__
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace yuliy_test_task::verify
+{
+  template <typename T>
+  using result_type = std::expected<T, std::string>;
+
+  /**
+   * What a verification pass learns about a range of tape values.
+   *
+   * Summaries of neighbouring ranges add up to the summary of the whole range,
+   * which lets the ranges be summarized in parallel.
+   */
+  struct Summary
+  {
+    std::size_t size = 0;
+    /// sum of the hashes of the values, the same for every order of them
+    std::uint64_t hash = 0;
+    /// index of the first value greater than the next one
+    std::optional<std::size_t> descent = std::nullopt;
+    std::int32_t first = 0;
+    std::int32_t last = 0;
+
+    /**
+     * Appends the summary of the range that follows this one.
+     *
+     * @param next The summary of the following range.
+     *
+     * @return This summary, now of both ranges.
+     */
+    auto operator+=(Summary const& next) -> Summary& {
+      if(next.size == 0)
+        return *this;
+      if(this->size == 0)
+        return *this = next;
+      if(not this->descent) {
+        if(this->last > next.first)
+          this->descent = this->size - 1;
+        else if(next.descent)
+          this->descent = this->size + *next.descent;
+      }
+      this->hash += next.hash;
+      this->size += next.size;
+      this->last = next.last;
+      return *this;
+    }
+
+    [[nodiscard]] auto sorted() const noexcept -> bool { return not this->descent; }
+
+    /**
+     * Checks if two summaries are of the same multiset of values.
+     *
+     * @return `true` if the sizes and the multiset hashes match.
+     */
+    [[nodiscard]] auto same_values(Summary const& other) const noexcept -> bool {
+      return this->size == other.size and this->hash == other.hash;
+    }
+  };
+
+  /**
+   * Hashes a value for the multiset hash, with the splitmix64 finalizer.
+   */
+  [[nodiscard]] constexpr auto hash(std::int32_t value) noexcept -> std::uint64_t {
+    auto x = static_cast<std::uint64_t>(static_cast<std::uint32_t>(value)) + 0x9E3779B97F4A7C15u;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9u;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBu;
+    return x ^ (x >> 31);
+  }
+
+  /**
+   * Summarizes a range of values on the calling thread.
+   *
+   * @param values The values.
+   *
+   * @return The summary of the values.
+   */
+  [[nodiscard]] inline auto summarize(std::span<std::int32_t const> values) -> Summary {
+    auto self = Summary { .size = values.size() };
+    if(values.empty())
+      return self;
+    self.first = values.front();
+    self.last = values.back();
+    if(auto const at = simd::first_descent(values); at != values.size())
+      self.descent = at;
+    for(auto const value : values)
+      self.hash += hash(value);
+    return self;
+  }
+
+  /**
+   * Summarizes a range of values, split evenly between threads.
+   *
+   * @param values The values.
+   * @param threads The number of threads, 0 for one per hardware thread.
+   *
+   * @return The summary of the values.
+   */
+  [[nodiscard]] inline auto summarize_parallel(std::span<std::int32_t const> values, std::size_t threads = 0) -> Summary {
+    if(threads == 0)
+      threads = std::max(1u, std::thread::hardware_concurrency());
+    // a thread is only worth it for a few pages of values
+    threads = std::clamp<std::size_t>(values.size() / (64 * 1024), 1, threads);
+    auto parts = std::vector<Summary>(threads);
+    {
+      auto workers = std::vector<std::jthread>();
+      workers.reserve(threads);
+      for(std::size_t t = 0; t < threads; ++t) {
+        auto const begin = values.size() * t / threads;
+        auto const end = values.size() * (t + 1) / threads;
+        workers.emplace_back([&parts, t, part = values.subspan(begin, end - begin)] { parts[t] = summarize(part); });
+      }
+    }
+    auto self = Summary();
+    for(auto const& part : parts)
+      self += part;
+    return self;
+  }
+
+  /**
+   * Summarizes a binary tape file of 32-bit values in one pass.
+   *
+   * On Linux the file is memory-mapped and summarized in parallel, elsewhere it
+   * is read in fixed blocks. Either way the memory used does not depend on the
+   * size of the tape.
+   *
+   * @param path The tape file.
+   * @param threads The number of threads, 0 for one per hardware thread.
+   *
+   * @return The summary of the tape, otherwise an std::unexpected with an error message.
+   */
+  [[nodiscard]] inline auto summarize_tape(std::filesystem::path const& path, std::size_t threads = 0) -> result_type<Summary> {
+    auto error = std::error_code();
+    auto const bytes = std::filesystem::file_size(path, error);
+    if(error)
+      return std::unexpected(std::format("failed to open tape {}: {}", path.generic_string(), error.message()));
+    if(bytes % sizeof(std::int32_t) != 0)
+      return std::unexpected(std::format("tape {} is {} bytes, not a whole number of values", path.generic_string(), bytes));
+    if(bytes == 0)
+      return Summary();
+#if defined __linux__
+    auto const fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if(fd < 0)
+      return std::unexpected(std::format("failed to open tape {}", path.generic_string()));
+    auto* const data = ::mmap(nullptr, bytes, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if(data == MAP_FAILED)
+      return std::unexpected(std::format("failed to map tape {}", path.generic_string()));
+    ::madvise(data, bytes, MADV_SEQUENTIAL);
+    auto const self = summarize_parallel(std::span(static_cast<std::int32_t const*>(data), bytes / sizeof(std::int32_t)), threads);
+    ::munmap(data, bytes);
+    return self;
+#else
+    auto ifs = std::ifstream(path, std::ios::binary);
+    if(not ifs)
+      return std::unexpected(std::format("failed to open tape {}", path.generic_string()));
+    auto block = std::vector<std::int32_t>(1024 * 1024);
+    auto self = Summary();
+    while(ifs) {
+      ifs.read(reinterpret_cast<char*>(block.data()), static_cast<std::streamsize>(block.size() * sizeof(std::int32_t)));
+      auto const n = static_cast<std::size_t>(ifs.gcount()) / sizeof(std::int32_t);
+      self += summarize_parallel(std::span<std::int32_t const>(block).first(n), threads);
+    }
+    return self;
+#endif
+  }
+} // namespace yuliy_test_task::verify
+
+#if defined UNIT_TESTS
+#include <gtest/gtest.h>
+#include <impl/common.hh>
+
+TEST(Verify, sorted_output_is_a_permutation_of_the_input)
+{
+  using namespace yuliy_test_task;
+  auto const in = *verify::summarize_tape(common::canonicalize("../tests/test_input2.tape"));
+  auto const out = *verify::summarize_tape(common::canonicalize("../tests/test_output2.tape"));
+  ASSERT_FALSE(in.sorted());
+  ASSERT_TRUE(out.sorted());
+  ASSERT_TRUE(in.same_values(out));
+  ASSERT_FALSE(verify::summarize_tape(common::canonicalize("../tests/test_input1.tape"))->same_values(out));
+}
+
+TEST(Verify, parallel_summary_matches_a_single_pass)
+{
+  using namespace yuliy_test_task;
+  // enough values for all seven threads
+  auto values = std::vector<std::int32_t>(7 * 64 * 1024);
+  for(std::size_t i = 0; i < values.size(); ++i)
+    values[i] = static_cast<std::int32_t>(i / 3);
+  auto const sorted = verify::summarize_parallel(values, 7);
+  ASSERT_TRUE(sorted.sorted());
+  ASSERT_EQ(sorted.hash, verify::summarize(values).hash);
+  // a descent right at the boundary of two threads' ranges
+  auto const boundary = values.size() * 3 / 7;
+  std::swap(values[boundary - 1], values[boundary + 5]);
+  auto const swapped = verify::summarize_parallel(values, 7);
+  ASSERT_EQ(swapped.descent, boundary - 1);
+  ASSERT_TRUE(swapped.same_values(sorted));
+  // the same values with one changed are another multiset
+  ++values[10];
+  ASSERT_FALSE(verify::summarize_parallel(values, 7).same_values(sorted));
+}
+#endif
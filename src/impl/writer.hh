@@ -0,0 +1,153 @@
+#pragma once
+
+#include <vector>
+#include <span>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <optional>
+#include <algorithm>
+#include <impl/itape.hh>
+#include <impl/memory.hh>
+
+namespace yuliy_test_task
+{
+  /**
+   * Double-buffered write-behind staging buffer for an output tape.
+   *
+   * Values are collected into a front block. When the block is full it is
+   * swapped with the back block and handed to a background writer thread,
+   * which flushes it with a single `write_and_shift_n` call while the caller
+   * keeps filling the front block. At most two blocks are alive at any time.
+   *
+   * The target is usually an output tape, but anything that provides
+   * `write_and_shift_n(std::span<T const>)` will do, such as a temporary run.
+   * It must not be touched by anyone else until `finish()` returns.
+   */
+  template <TapeElement T, typename Target = ITape<T>>
+  class WriteBehindBuffer
+  {
+    public:
+      template <typename U>
+      using result_type = ITape<T>::template result_type<U>;
+
+      /**
+       * Creates a buffer and starts its writer thread.
+       *
+       * @param tape The tape to write to.
+       * @param block_elems The number of elements in each of the two blocks.
+       * @param budget The memory budget the two blocks are charged to, if any.
+       */
+      WriteBehindBuffer(Target& tape, std::size_t block_elems, MemoryBudget* budget = nullptr)
+        : tape_(tape)
+        , block_elems_(std::max<std::size_t>(1, block_elems))
+        , front_(BudgetAllocator<T>(budget))
+        , back_(BudgetAllocator<T>(budget)) {
+        this->front_.reserve(this->block_elems_);
+        this->back_.reserve(this->block_elems_);
+        this->thread_ = std::thread([this] { this->run(); });
+      }
+
+      /**
+       * Flushes the remaining values and stops the writer thread.
+       *
+       * Errors are dropped here, call `finish()` to observe them.
+       */
+      ~WriteBehindBuffer() noexcept {
+        std::ignore = this->finish();
+      }
+
+      WriteBehindBuffer(WriteBehindBuffer const&) = delete;
+      WriteBehindBuffer& operator=(WriteBehindBuffer const&) = delete;
+
+      /**
+       * Stages a single value.
+       *
+       * @param value The value to stage.
+       */
+      auto push(T value) -> void {
+        this->front_.push_back(value);
+        if(this->front_.size() == this->block_elems_)
+          this->submit();
+      }
+
+      /**
+       * Stages a contiguous range of values with bulk copies.
+       *
+       * @param values The values to stage.
+       */
+      auto push(std::span<T const> values) -> void {
+        while(not values.empty()) {
+          auto const n = std::min(values.size(), this->block_elems_ - this->front_.size());
+          this->front_.insert(this->front_.end(), values.begin(), values.begin() + n);
+          values = values.subspan(n);
+          if(this->front_.size() == this->block_elems_)
+            this->submit();
+        }
+      }
+
+      /**
+       * Flushes all staged values and joins the writer thread.
+       *
+       * Calling this function more than once is allowed, subsequent calls only
+       * report the result of the first one.
+       *
+       * @return An empty result if every block was written, otherwise the first
+       * error reported by the tape.
+       */
+      [[nodiscard]] auto finish() -> result_type<void> {
+        if(this->thread_.joinable()) {
+          if(not this->front_.empty())
+            this->submit();
+          {
+            auto lock = std::unique_lock(this->mutex_);
+            this->stop_ = true;
+          }
+          this->cv_.notify_all();
+          this->thread_.join();
+        }
+        if(this->error_)
+          return std::unexpected(*this->error_);
+        return {};
+      }
+
+    private:
+      auto submit() -> void {
+        {
+          auto lock = std::unique_lock(this->mutex_);
+          this->cv_.wait(lock, [this] { return not this->pending_; });
+          std::swap(this->front_, this->back_);
+          this->pending_ = true;
+        }
+        this->cv_.notify_all();
+      }
+
+      auto run() -> void {
+        auto lock = std::unique_lock(this->mutex_);
+        while(true) {
+          this->cv_.wait(lock, [this] { return this->pending_ or this->stop_; });
+          if(not this->pending_)
+            return;
+          lock.unlock();
+          auto res = this->error_ ? result_type<void>() : this->tape_.write_and_shift_n(this->back_);
+          this->back_.clear();
+          lock.lock();
+          if(not res and not this->error_)
+            this->error_ = std::move(res.error());
+          this->pending_ = false;
+          this->cv_.notify_all();
+        }
+      }
+
+      Target& tape_;
+      std::size_t block_elems_;
+      budget_vector<T> front_;
+      budget_vector<T> back_;
+      std::mutex mutex_;
+      std::condition_variable cv_;
+      bool pending_ = false;
+      bool stop_ = false;
+      std::optional<std::string> error_;
+      std::thread thread_;
+  };
+} // namespace yuliy_test_task
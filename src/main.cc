@@ -27,21 +27,115 @@
 #include <impl/config.hh>
 #include <impl/tape.hh>
 #include <impl/sort.hh>
+#include <impl/plan.hh>
+#include <impl/checkpoint.hh>
+
+#include <vector>
+#include <optional>
+#include <string_view>
+#include <string>
+#include <utility>
 
 using namespace yuliy_test_task;
 
+namespace
+{
+  struct Options
+  {
+    std::vector<std::string_view> positional;
+    std::optional<std::size_t> displacement;
+    std::optional<algorithm::KeyRange<int32_t>> key_range;
+    std::optional<std::string_view> checkpoint;
+    bool resume = false;
+    bool plan_only = false;
+  };
+
+  template <typename Delay>
+  auto run(Config const& config, Options const& options) -> int {
+    auto in = *BinaryTape<int32_t, Delay>::open(common::canonicalize(options.positional[0]), config.device(TapeRole::Input));
+    auto const plan = algorithm::make_plan<int32_t>(config, in->size(), options.key_range);
+    common::println("{}", plan);
+    if(options.plan_only)
+      return 0;
+    auto out = *BinaryTape<int32_t, Delay>::open(common::canonicalize(options.positional[1]), config.device(TapeRole::Output));
+    auto scratch = TapeStats();
+    auto const res = options.checkpoint
+      ? algorithm::sort_checkpointed_into(*in, *out, *options.checkpoint, options.resume, true, &scratch)
+      : options.displacement
+        ? algorithm::sort_nearly_sorted_into(*in, *out, *options.displacement, true, &scratch)
+        : algorithm::execute(plan, *in, *out, true, &scratch);
+    if(not res)
+      common::panic(1, "Error: {}", res.error());
+    for(auto const& [role, stats] : { std::pair { TapeRole::Input, in->stats() }, std::pair { TapeRole::Output, out->stats() }, std::pair { TapeRole::Scratch, scratch } })
+      common::println("{:<7}: {} reads, {} writes, {} shifts, {} rewinds, {} stalls, {} reversals, modeled {}",
+        to_string(role), stats.reads, stats.writes, stats.shifts, stats.rewinds, stats.stalls, stats.reversals,
+        stats.modeled_time(config.device(role)));
+    common::println("{:<7}: peak {} of {} bytes, {} heap fallbacks", "memory", config.budget().peak(), config.budget().limit(),
+      config.budget().heap_fallbacks());
+    auto const& space = config.scratch();
+    common::println("{:<7}: peak {} bytes, {} in memory, {} in memfd, {} on disk, {} spills, {} files created, {} reused", "runs",
+      space.peak_total(), space.peak(ScratchTier::Memory), space.peak(ScratchTier::Memfd), space.peak(ScratchTier::Disk), space.spills(),
+      space.created_files(), space.reused_files());
+    if(space.directories().size() > 1)
+      for(std::size_t i = 0; i < space.directories().size(); ++i)
+        common::println("{:<7}: {} files in {}", "volume", space.placed(i), space.directories()[i].generic_string());
+    if constexpr(std::same_as<Delay, VirtualDelay>)
+      common::println("{:<7}: virtual {}", "clock", std::chrono::duration_cast<std::chrono::microseconds>(VirtualDelay::now()));
+    if constexpr(std::same_as<Delay, RealDelay>) {
+      DelayEngine::settle();
+      auto const requested = std::chrono::duration_cast<std::chrono::microseconds>(DelayEngine::requested());
+      auto const paid = std::chrono::duration_cast<std::chrono::microseconds>(DelayEngine::paid());
+      common::println("{:<7}: requested {}, paid {}, error {:+.2f}%", "delay", requested, paid,
+        requested.count() == 0 ? 0.0 : 100.0 * static_cast<double>((paid - requested).count()) / static_cast<double>(requested.count()));
+    }
+    common::println("Done.");
+    return 0;
+  }
+} // namespace
+
 auto main(int argc, char* argv[]) -> int try {
-  if(argc != 3)
-    common::panic(1, "usage: {} <input tape> <output tape>", argv[0]);
+  auto const usage = [&] {
+    common::panic(1, "usage: {} [--plan-only] [--key-range <lo>:<hi>] [--displacement <D>] [--checkpoint <dir> [--resume]] <input tape> <output tape>", argv[0]);
+  };
+  auto options = Options();
+  for(auto i = 1; i < argc; ++i) {
+    auto const arg = std::string_view(argv[i]);
+    if(arg == "--displacement") {
+      if(++i == argc)
+        usage();
+      options.displacement = std::stoull(argv[i]);
+    } else if(arg == "--key-range") {
+      if(++i == argc)
+        usage();
+      auto const range = std::string(argv[i]);
+      auto const colon = range.find(':', 1);
+      if(colon == std::string::npos)
+        usage();
+      options.key_range = algorithm::KeyRange<int32_t> { std::stoi(range.substr(0, colon)), std::stoi(range.substr(colon + 1)) };
+    } else if(arg == "--checkpoint") {
+      if(++i == argc)
+        usage();
+      options.checkpoint = argv[i];
+    } else if(arg == "--resume")
+      options.resume = true;
+    else if(arg == "--plan-only")
+      options.plan_only = true;
+    else
+      options.positional.push_back(arg);
+  }
+  if(options.positional.size() != (options.plan_only ? 1 : 2) or (options.resume and not options.checkpoint))
+    usage();
   auto const config = *Config::from_pwd();
   common::println("{}", config);
-  *algorithm::sort_into(
-    **BinaryTape<int32_t>::create(common::canonicalize(argv[1]), config),
-    **BinaryTape<int32_t>::create(common::canonicalize(argv[2]), config),
-    true
-  );
-  common::println("Done.");
-  return 0;
+  switch(config.delay_mode()) {
+    case DelayMode::Virtual:
+      return run<VirtualDelay>(config, options);
+    case DelayMode::None:
+      return run<NoDelay>(config, options);
+    case DelayMode::Real:
+      break;
+  }
+  return run<RealDelay>(config, options);
 } catch(std::exception const& e) {
   common::panic(1, "Error: {}", e.what());
 }
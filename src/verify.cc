@@ -0,0 +1,37 @@
+/*
+ * Checks that an output tape is the sorted input tape: the output must be in
+ * ascending order and hold the same multiset of values as the input.
+ */
+
+#include <impl/common.hh>
+#include <impl/verify.hh>
+
+#include <chrono>
+#include <string>
+
+using namespace yuliy_test_task;
+
+auto main(int argc, char* argv[]) -> int try {
+  if(argc != 3 and argc != 4)
+    common::panic(2, "usage: {} <input tape> <output tape> [threads]", argv[0]);
+  auto const threads = argc == 4 ? std::stoull(argv[3]) : std::size_t(0);
+  auto const start = std::chrono::steady_clock::now();
+  auto const in = verify::summarize_tape(common::canonicalize(argv[1]), threads);
+  if(not in)
+    common::panic(2, "Error: {}", in.error());
+  auto const out = verify::summarize_tape(common::canonicalize(argv[2]), threads);
+  if(not out)
+    common::panic(2, "Error: {}", out.error());
+  auto const elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+  common::println("{:<7}: {} values, hash {:016x}", "input", in->size, in->hash);
+  common::println("{:<7}: {} values, hash {:016x}", "output", out->size, out->hash);
+  if(out->descent)
+    common::println("sorted : no, value {} is greater than the next one", *out->descent);
+  else
+    common::println("sorted : yes");
+  common::println("values : {}", in->same_values(*out) ? "same as the input" : "differ from the input");
+  common::println("time   : {}", elapsed);
+  return out->sorted() and in->same_values(*out) ? 0 : 1;
+} catch(std::exception const& e) {
+  common::panic(2, "Error: {}", e.what());
+}
@@ -3,7 +3,17 @@
 //
 
 #include <gtest/gtest.h>
+#include <impl/delay.hh>
 #include <impl/tape.hh>
+#include <impl/simd.hh>
+#include <impl/sort.hh>
+#include <impl/oscillating.hh>
+#include <impl/sample.hh>
+#include <impl/distribution.hh>
+#include <impl/plan.hh>
+#include <impl/checkpoint.hh>
+#include <impl/verify.hh>
+#include <impl/generate.hh>
 
 auto main(int argc, char** argv) -> int
 {